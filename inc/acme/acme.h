@@ -39,6 +39,12 @@
 #define AcmeSentinelInc    AcmeSentinelDir "sentinel.h"
 #define AcmeHashServer     AcmeDaemonDir "hash.c"
 #define AcmeHashServerInc  AcmeIncDir    "hash.h"
+#define AcmeUserIndex      AcmeDaemonDir "user_index.c"
+#define AcmeUserIndexInc   AcmeIncDir    "user_index.h"
+#define AcmeCloneIndex     AcmeDaemonDir "clone_index.c"
+#define AcmeCloneIndexInc  AcmeIncDir    "clone_index.h"
+#define AcmeTargetFlush    AcmeDaemonDir "target_flush.c"
+#define AcmeTargetFlushInc AcmeIncDir    "target_flush.h"
 
 //------------------------------ include files ------------------------------//
 
@@ -15,17 +15,33 @@ mixed  checked_item_reverse(mixed *list, int i);
 mixed  wrapped_item      ( mixed *list, int i );
 mixed *flatten_array1    ( mixed *list );
 mixed *flatten_array     ( mixed *list );
+mixed *flatten_array_n   ( mixed *list, int depth );
 mixed *unique_array      ( mixed *list );
 mixed *intersect_array   ( mixed *orig1, mixed *orig2 );
 mixed *exclude_array     ( mixed *orig1, mixed *orig2 );
+mixed *exclude_array_ordered( mixed *orig1, mixed *orig2 );
 varargs int anti_searcha ( mixed list, mixed el, int start, int step );
 varargs int searcha_any  ( mixed list, mixed els, int start, int step );
 varargs int anti_searcha_any( mixed list, mixed el, int start, int step );
 int *to_int_range        ( string range );
 mixed *typecast_array    ( mixed *arr, int type );
 int *random_array        ( int size );
+int *random_subset       ( int n, int k );
+mixed *reservoir_sample  ( mixed src, int k );
 mixed *unique_array_slow ( mixed *arr, int keep_last );
+mixed *unique_array_ordered( mixed *arr, int keep_last );
 varargs mixed *sort_alist( mixed *arr, mixed call, object ob );
+varargs int *sort_permutation( mixed *keys, closure cmp );
+mixed *apply_permutation ( mixed *arr, int *perm );
+varargs mixed nth_element( mixed *arr, int k, closure cmp );
+varargs mixed *top_k     ( mixed *arr, int k, mixed key );
+mixed *min_max           ( mixed *arr );
+varargs int map_array_sliced   ( mixed *arr, closure cl, closure done,
+                                 int budget );
+varargs int filter_array_sliced( mixed *arr, closure cl, closure done,
+                                 int budget );
+mapping query_array_sliced     ( int handle );
+status  cancel_array_sliced    ( int handle );
 varargs mixed acc_array( mixed elements, closure cl, mixed start, mixed args );
 
 #endif
@@ -0,0 +1,9 @@
+#ifndef ACME_CLONE_INDEX_INC
+#define ACME_CLONE_INDEX_INC
+
+object *query_clones      ( string file );
+void    register_clone    ();
+void    unregister_clone  ();
+string *query_watched     ();
+
+#endif
@@ -5,5 +5,6 @@
 
 mixed choose_variant ( mixed *choices );    // chooses among various weighted
                                             // options
+mixed *choose_variants ( mixed *choices, int k );   // several different ones
 
 #endif  // ACME_CVAR_INC
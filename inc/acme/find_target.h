@@ -9,6 +9,8 @@ varargs object *find_targets(string spec, string priorities,
 object  find_target ( string targ, string pat );
 object *find_inherit( string name, string iname );
 
+varargs void flush_target_cache( object who );
+
 #define FT_FindPlayer     "p"
 #define FT_FindPlayerChar 'p'
 
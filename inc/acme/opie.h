@@ -13,11 +13,26 @@
 #undef opie_help
 #undef opie_which
 #undef opie_set
+#undef opie_profile
+#undef opie_profile_p
+#undef opie_profile_report
+#undef opie_store
+#undef opie_store_p
+#undef opie_fetch
+#undef opie_refine
+#undef opie_release
+#undef opie_forget_engine
+#undef opie_many
+#undef opie_many_p
+#undef opie_many_l
 #define opieVar "opie"
 
 #define opieFunc     "evaluate_object_spec"
 #define opieHelpFunc "object_spec_help"
 #define opieSetFunc  "object_spec_variable_set"
+#define opieProfileFunc "profile_object_spec"
+#define opieRefineFunc  "refine_object_spec"
+#define opieManyFunc    "evaluate_object_specs"
 
 #define opieDir    "/zone/null/acme/opie/"
 #define opieServer opieDir "opie.c"
@@ -12,7 +12,22 @@
 #define opie_p(arg, pr)  (call_other(opieServer, "opie", arg, pr))
 #define opie1_p(arg, pr) (call_other(opieServer, "opie1", arg, pr))
 
+#define opie_many(specs)         (call_other(opieServer, "opie_many", specs))
+#define opie_many_p(specs, pr)   (call_other(opieServer, "opie_many", specs, pr))
+#define opie_many_l(specs, lim)  (call_other(opieServer, "opie_many", specs, 0, lim))
+
 #define opie_help()    (call_other(opieServer, "help"))
 #define opie_set(k,v)  (call_other(opieServer, "set", k, v))
 
+#define opie_profile(arg)         (call_other(opieServer, "profile", arg))
+#define opie_profile_p(arg, pr)   (call_other(opieServer, "profile", arg, pr))
+#define opie_profile_report(arg)  (call_other(opieServer, "profile_report", arg))
+
+#define opie_store(arg)         (call_other(opieServer, "store", arg))
+#define opie_store_p(arg, pr)   (call_other(opieServer, "store", arg, pr))
+#define opie_fetch(h, s, n)     (call_other(opieServer, "fetch", h, s, n))
+#define opie_refine(h, arg)     (call_other(opieServer, "refine", h, arg))
+#define opie_release(h)         (call_other(opieServer, "release", h))
+
 #define opie_which()   (call_other(opieServer, "choose_engine"))
+#define opie_forget_engine(who)  (call_other(opieServer, "forget_engine", who))
@@ -1,9 +1,31 @@
 #ifndef ACME_OSPEC_INC
 #define ACME_OSPEC_INC
 
-object *parse_ospec         (string ospec, object *prev, string priorities);
-object *evaluate_object_spec(string ospec, object tool,  string priorities);
+varargs object *parse_ospec (string ospec, object *prev, string priorities,
+                             int limit);
+varargs object *evaluate_object_spec(string ospec, object tool,
+                                     string priorities, int limit);
+varargs mixed *parse_ospecs (string *specs, string priorities,
+                             int *limits);
+varargs mixed *evaluate_object_specs(string *specs, object tool,
+                                     string priorities, int *limits);
 string object_spec_help ();
 void   object_spec_variable_set ( mixed key, mixed value );
+void   flush_ospec_plans ();
+void   flush_mapfile_cache ();
+varargs void forget_history (string dataspace);
+static varargs status register_ospec_operator (string kind, string token,
+                                               closure func, closure stream);
+static varargs void set_ospec_impure (string name, status flag);
+varargs int parse_ospec_async (string ospec, closure callback,
+                               string priorities, int budget);
+mapping query_ospec_async (int handle);
+status  cancel_ospec_async (int handle);
+varargs mixed *profile_ospec (string ospec, object *prev, string priorities,
+                              int limit);
+varargs mixed *profile_object_spec(string ospec, object tool,
+                                   string priorities, int limit);
+varargs object *refine_object_spec(string ospec, object *prev, object tool,
+                                   string priorities);
 
 #endif
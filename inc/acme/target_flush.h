@@ -0,0 +1,7 @@
+#ifndef ACME_TARGET_FLUSH_INC
+#define ACME_TARGET_FLUSH_INC
+
+int     query_stamp       ( object who );
+varargs void flush        ( object who );
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ACME_USER_INDEX_INC
+#define ACME_USER_INDEX_INC
+
+object *query_level_range ( int min, int max );
+object *query_host_suffix ( string suffix );
+mapping make_site_trie    ( string *sites );
+string *match_site_trie   ( mapping trie, string host );
+void    update_user       ( object who );
+void    reindex           ();
+
+#endif
@@ -80,44 +80,61 @@ explode_args(string arg)
     Notes:
       [ospec] becomes a single object named by the ospec
       {ospec} becomes an array of objects named by the ospec
+      All the ospecs are handed to Opie in one opie_many() call, with
+      a limit of 1 for each [ospec], as opie1() would have.  So "$"
+      afterwards is the one object, and the spec stops once it's found.
 */
 mixed *
 eval_args(string *args)
 {
-  int i, size, len, val;
-  mixed result;
-  mixed *new_array;
+  int i, j, size, len, val;
+  mixed *new_array, *lists;
+  string *specs;
+  int *where, *limits;
 
-  new_array = ({ });
-  
-  for(i=0, size = sizeof(args); i < size; i++)
+  new_array = allocate(size = sizeof(args));
+  specs = ({ });
+  where = ({ });
+  limits = ({ });
+
+  for(i=0; i < size; i++)
   {
     if((sscanf(args[i], "%d", val))
        && ( to_string( val ) == args[i] ))
-      result = val;
+      new_array[i] = val;
     else if((len = strlen(args[i])) < 2)
-      result = args[i];
+      new_array[i] = args[i];
     else
     {
       switch(args[i][0..0] + args[i][len-1..len-1])
       {
         case "[]":
-          result = opie1(args[i][1..len-2]);
-          break;
         case "{}":
-          result = opie(args[i][1..len-2]);
+          specs += ({ args[i][1..len-2] });
+          where += ({ i });
+          limits += ({ args[i][0] == '[' });
           break;
         default:
-          result = args[i];
+          new_array[i] = args[i];
       } /* switch */
     } /* if(strlen...) */
-
-    new_array += ({ result });
-    
   } /* for */
 
+  if(!sizeof(specs))
+    return new_array;
+
+  lists = opie_many_l(specs, limits) || allocate(sizeof(specs));
+  for(j=0, size = sizeof(where); j < size; j++)
+  {
+    i = where[j];
+    if(args[i][0] == '{')
+      new_array[i] = lists[j];
+    else  /* [ospec] */
+      new_array[i] = (pointerp(lists[j]) && sizeof(lists[j]))
+                     ? lists[j][0] : 0;
+  }
+
   return new_array;
-  
 }
 
 
@@ -12,11 +12,14 @@
         wrapped_item()    - Same as checked_item() but wraps around
         flatten_array1()  - Flatten out an array by only one level
         flatten_array()   - Flatten out an array entirely (depth first)
+        flatten_array_n() - Flatten out an array by some number of levels
         unique_array()    - Returns a copy of the array with no duplicates
         unique_array_slow() - unique_array() without side effects
+        unique_array_ordered() - Same thing, in linear time
         add_array()       - Add two arrays together, checks for nulls.
         intersect_array() - Array-AND
         exclude_array()   - Array subtraction
+        exclude_array_ordered() - Same, keeping the order of the first array
         prepend_array()   - prepends something to each item in an array
         anti_searcha()    - returns position of first element that isn't <el>
         searcha_any()     - like member, but will match on any of a set
@@ -25,8 +28,19 @@
         to_int_range()    - returns an array of integers that match a range
         typecast_array()  - make all values in an array the same type
         random_array()    - generate an array of random values
+        random_subset()   - pick a few of them, without making them all
+        reservoir_sample() - pick a few elements from an array or a stream
         sort_alist()      - sorts an alist respective to the values of the keys
+        sort_permutation() - the order sort_array() would put an array in
+        apply_permutation() - put an array in that order
         acc_array() - compound elements through a closure
+        nth_element()     - what sort_array() would put at some index
+        top_k()           - the k elements with the highest keys
+        min_max()         - the lowest and highest elements
+        map_array_sliced()    - map_array() spread over call_outs
+        filter_array_sliced() - filter_array() spread over call_outs
+        query_array_sliced()  - how far along one of those is
+        cancel_array_sliced() - give up on it
     NOTES
         None.
     LAST MODIFIED
@@ -185,25 +199,95 @@ wrapped_item(mixed *list, int i)
 /*
 ** Turns ({ ({ a, b }), c, ({ d, ({ e }) }) }) 
 ** into  ({ a, b, c, d, ({ e }) }) 
+**
+** Counts first and fills in a new array, rather than adding on to
+** the result a piece at a time, which copied it over and over.
 */
 mixed
 flatten_array1(mixed *list)
 {
   mixed *newlist;
-  int i, size;
+  int i, j, n, len, size;
 
   if(!pointerp(list))
     return ({ });
 
   size = sizeof(list);
-  newlist = ({ });
+  for(i=0; i < size; i++)
+    n += pointerp(list[i]) ? sizeof(list[i]) : 1;
+
+  newlist = allocate(n);
   for(i=0; i < size; i++)
   {
-    if(pointerp(list[i]))
-      newlist += list[i];
-    else
-      newlist += ({ list[i] });
+    if(!pointerp(list[i]))
+      newlist[j++] = list[i];
+    else if(len = sizeof(list[i]))
+    {
+      newlist[j..j+len-1] = list[i];
+      j += len;
+    }
+  }
+  return newlist;
+}
+
+/*
+** Walks list depth first, going at most depth levels down (or all
+** the way, if depth < 0), without recursing.  Puts what it finds in
+** out, if out isn't 0, and returns how many things it found.
+** Used by flatten_array() and flatten_array_n() to size the result
+** and then to fill it in.
+*/
+private int
+flatten_walk(mixed *list, int depth, mixed *out)
+{
+  mixed *lists, el;
+  int *pos;
+  int sp, n;
+
+  lists = allocate(16);
+  pos = allocate(16);
+  lists[0] = list;
+  while(sp >= 0)
+  {
+    if(pos[sp] >= sizeof(lists[sp]))
+    {
+      lists[sp--] = 0;
+      continue;
+    }
+    el = lists[sp][pos[sp]++];
+    if(pointerp(el) && ((depth < 0) || (sp < depth)))
+    {
+      if(++sp >= sizeof(lists))
+      {
+        lists += allocate(sizeof(lists));
+        pos += allocate(sizeof(pos));
+      }
+      lists[sp] = el;
+      pos[sp] = 0;
+      continue;
+    }
+    if(out)
+      out[n] = el;
+    n++;
   }
+  return n;
+}
+
+/*
+** Same as flatten_array(), but only flattens depth levels.
+** flatten_array_n(list, 1) is the same as flatten_array1(list),
+** and a negative depth flattens it entirely.  Like flatten_array1(),
+** it gives ({ }) for something that isn't an array.
+*/
+mixed
+flatten_array_n(mixed *list, int depth)
+{
+  mixed *newlist;
+
+  if(!pointerp(list))
+    return ({ });
+  newlist = allocate(flatten_walk(list, depth, 0));
+  flatten_walk(list, depth, newlist);
   return newlist;
 }
 
@@ -214,18 +298,9 @@ flatten_array1(mixed *list)
 mixed
 flatten_array(mixed *list)
 {
-    mixed *newlist;
-    int i, max;;
-
-    if (!pointerp(list))
-        return ({ list });
-    newlist = ({});
-    max = sizeof(list);
-    for (i=0; i < max; i++)
-    {
-        newlist += flatten_array(list[i]);
-    }
-    return newlist;
+  if(!pointerp(list))
+    return ({ list });
+  return flatten_array_n(list, -1);
 }
 
 /*
@@ -238,30 +313,54 @@ unique_array(mixed *array)
 }
 
 /*
-** Returns a copy of the array with no duplicates in the same
-** order as original array.
+** Returns a copy of the array with no duplicates, in the same order
+** as the original array.  Keeps the last copy of each element rather
+** than the first if keep_last is set.  Remembers what it has seen in a
+** mapping, so it takes time in proportion to the size of the array.
 */
-varargs mixed *
-unique_array_slow( mixed *arr, int keep_last )
+mixed *
+unique_array_ordered( mixed *arr, int keep_last )
 {
+  mapping seen;
   mixed *out;
-  int i, j, found;
-  out = ({ });
+  int i, j, size;
+
+  size = sizeof( arr );
+  out = allocate( size );
+  seen = ([ ]);
   if( keep_last )
   {
-    for( i=sizeof(arr)-1; i>=0; i-- )
-      if( member( out, arr[i] ) == -1 )
-        out = ({ arr[i] }) + out;
+    // Fill in from the end, then return the part that got used.
+    for( i=size-1, j=size; i>=0; i-- )
+      if( !member( seen, arr[i] ) )
+      {
+        seen[arr[i]] = 1;
+        out[--j] = arr[i];
+      }
+    return out[j..];
   }
-  else
-  {
-    for( i=0, j=sizeof(arr); i<j; i++ )
-      if( member( out, arr[i] ) == -1 )
-        out += ({ arr[i] });
-  }
-  return out;
+
+  for( i=0; i<size; i++ )
+    if( !member( seen, arr[i] ) )
+    {
+      seen[arr[i]] = 1;
+      out[j++] = arr[i];
+    }
+  return out[0..j-1];
 }
 
+/*
+** Returns a copy of the array with no duplicates in the same
+** order as original array.  (It's not slow any more; it's just
+** unique_array_ordered() under its old name.)
+*/
+varargs mixed *
+unique_array_slow( mixed *arr, int keep_last )
+{
+  return unique_array_ordered( arr, keep_last );
+}
+
+
 /* 
 ** Array-AND
 **  Order is the same as the first array. 
@@ -280,6 +379,33 @@ intersect_array(mixed *orig1, mixed *orig2)
 */
 }
 
+/*
+**  Same as exclude_array(), but the result is in the same order as
+**  the first array (still without duplicates).  Takes time in
+**  proportion to the size of the two arrays.
+*/
+mixed *
+exclude_array_ordered(mixed *orig1, mixed *orig2)
+{
+  mapping seen;
+  mixed *out;
+  int i, j, size;
+
+  // Anything in orig2 counts as already seen, so it's left out.
+  seen = ([ ]);
+  for(i=0, size = sizeof(orig2); i < size; i++)
+    seen[orig2[i]] = 1;
+
+  out = allocate(size = sizeof(orig1));
+  for(i=0; i < size; i++)
+    if(!member(seen, orig1[i]))
+    {
+      seen[orig1[i]] = 1;
+      out[j++] = orig1[i];
+    }
+  return out[0..j-1];
+}
+
 /* 
 **  Removes from the first array all occurances 
 **  of any items in the second
@@ -287,14 +413,10 @@ intersect_array(mixed *orig1, mixed *orig2)
 mixed *
 exclude_array(mixed *orig1, mixed *orig2)
 {
-  mixed hash;
-  hash = mkmapping(orig2);
-  return unique_array(filter_array(orig1, 
-                                   lambda(({ 'e }), 
-                                          ({ #'!, 
-                                               ({ #'member, hash, 'e }) }))));
+  return exclude_array_ordered(orig1, orig2);
 }
 
+
 /*
 ** Prepends something to each item in an array
 */
@@ -525,6 +647,179 @@ random_array( int size )
   return out;
 }
 
+/*----------------------------- random_subset -----------------------------*/
+/*
+    Description:
+      Pick k different numbers from 0 to n-1, at random.
+    Parameters:
+      n - how many numbers there are to choose from
+      k - how many are wanted
+    Returns:
+      An array of k different numbers, in random order, or all n of
+      them if k > n.
+    Notes:
+      Does the first k steps of the shuffle random_array() does, but
+      keeps track of the numbers it has moved in a mapping instead of
+      making an array of all n, so it takes time and memory in
+      proportion to k.  random_subset(n, n) is random_array(n).
+*/
+int *
+random_subset( int n, int k )
+{
+  mapping moved;
+  int *out, i, j;
+
+  if( k > n )
+    k = n;
+  if( k < 0 )
+    k = 0;
+  out = allocate(k);
+  moved = ([ ]);
+  for( i=0; i<k; i++ )
+  {
+    // Swap position i with a random position j >= i, and keep what
+    // ends up at i.  Positions that haven't moved hold themselves.
+    j = i + random(n - i);
+    out[i] = member( moved, j ) ? moved[j] : j;
+    moved[j] = member( moved, i ) ? moved[i] : i;
+    m_delete( moved, i );
+  }
+  return out;
+}
+
+/*--------------------------- reservoir_sample ----------------------------*/
+/*
+    Description:
+      Pick k elements at random from an array, or from a stream of
+      elements too big to put in one.
+    Parameters:
+      src - an array, or a closure which returns the next few
+            elements as an array each time it's called, and 0 or ({ })
+            when there aren't any more
+      k   - how many elements are wanted
+    Returns:
+      k elements picked at random, each with the same chance, or all
+      of them if there are fewer than k.
+    Notes:
+      Only keeps k elements at a time, however many src has.
+      The result isn't in any particular order.
+*/
+mixed *
+reservoir_sample( mixed src, int k )
+{
+  mixed *out, *batch;
+  int seen, i, j, size;
+
+  if( k < 0 )
+    k = 0;
+  out = allocate(k);
+  batch = closurep(src) ? funcall(src) : src;
+  while( pointerp(batch) && (size = sizeof(batch)) )
+  {
+    for( i=0; i<size; i++, seen++ )
+    {
+      // The n'th element replaces one already picked with chance k/n.
+      if( seen < k )
+        out[seen] = batch[i];
+      else if( (j = random(seen + 1)) < k )
+        out[j] = batch[i];
+    }
+    batch = closurep(src) ? funcall(src) : 0;
+  }
+  return (seen < k) ? out[0..seen-1] : out;
+}
+
+/*--------------------------- sort_permutation ----------------------------*/
+/*
+    Description:
+      Works out the order sort_array() would put an array in, without
+      moving anything.
+    Parameters:
+      keys - the array to sort by
+      cmp  - a closure that works like sort_array()'s: true if its
+             first argument belongs after its second.  Defaults to #'>.
+    Returns:
+      An array of indices into keys, in sorted order, so that
+      keys[perm[0]] is the first key, keys[perm[1]] the second...
+    Notes:
+      Keys that tie stay in the order they were in.
+      With #'> (lowest first) or #'< (highest first) on ints, floats
+      or strings, the keys themselves are sorted with the efun, and no
+      closure of ours is called per comparison.  Any other cmp gets
+      one lambda per call.
+*/
+varargs int *
+sort_permutation( mixed *keys, closure cmp )
+{
+  mapping first;
+  mixed *sorted;
+  int *perm, *next;
+  int i, size;
+
+  size = sizeof( keys );
+  if( !cmp )
+    cmp = #'>;
+
+  if( cmp == #'> || cmp == #'< )
+  {
+    // Chain together the indices of each key, in order, then walk
+    // the chains as the sorted keys come by.
+    first = ([ ]);
+    next = allocate( size );
+    for( i=size-1; i>=0; i-- )
+    {
+      next[i] = member( first, keys[i] ) ? first[keys[i]] : -1;
+      first[keys[i]] = i;
+    }
+    sorted = sort_array( keys, cmp );
+    perm = allocate( size );
+    for( i=0; i<size; i++ )
+    {
+      perm[i] = first[sorted[i]];
+      first[sorted[i]] = next[perm[i]];
+    }
+    return perm;
+  }
+
+  perm = allocate( size );
+  for( i=0; i<size; i++ )
+    perm[i] = i;
+  keys = quote( keys );
+  return sort_array( perm, lambda( ({ 'x, 'y }),
+    ({ #'?,
+       ({ #'funcall, cmp, ({ #'[, keys, 'x }), ({ #'[, keys, 'y }) }), 1,
+       ({ #'funcall, cmp, ({ #'[, keys, 'y }), ({ #'[, keys, 'x }) }), 0,
+       ({ #'>, 'x, 'y }) }) ) );
+}
+
+/*--------------------------- apply_permutation ---------------------------*/
+/*
+    Description:
+      Puts an array in the order given by a permutation.
+    Parameters:
+      arr  - the array to reorder
+      perm - an array of indices into arr, from sort_permutation()
+    Returns:
+      arr, which now holds what used to be arr[perm[0]], arr[perm[1]]...
+    Notes:
+      arr is changed in place, so any number of parallel arrays can be
+      put in the same order by calling this on each of them.  Pass a
+      copy (arr + ({ })) if you want to keep the original.
+*/
+mixed *
+apply_permutation( mixed *arr, int *perm )
+{
+  mixed *was;
+  int i, size;
+
+  if( (size = sizeof(arr)) != sizeof(perm) )
+    raise_error( "Bad argument 2 to apply_permutation()\n" );
+  was = arr + ({ });
+  for( i=0; i<size; i++ )
+    arr[i] = was[perm[i]];
+  return arr;
+}
+
 /*------------------------------ sort_alist ------------------------------*/
 /*
     Description:
@@ -540,12 +835,14 @@ random_array( int size )
       ( ie. ({ ({ 3, 2, 1 }), ({ 4, 5, 6 }) }) -> 
             ({ ({ 1, 2, 3 }), ({ 6, 5, 4 }) }) )
     Notes:
-      None.
+      The arrays are put in order with sort_permutation(), so #'> and
+      #'< need no closure per comparison.
 */
 varargs mixed *
 sort_alist( mixed *arr, mixed call, object ob )
 {
-  mixed *keys;
+  mixed *out;
+  int *perm;
   closure cl;
   int i, size;
   if( !size = sizeof(arr) )
@@ -559,11 +856,11 @@ sort_alist( mixed *arr, mixed call, object ob )
   for( i=0; i<size; i++ )
     if( !pointerp(arr[i]) || sizeof(arr[i]) != sizeof(arr[0]) )
       raise_error( "Bad argument 1 to sort_alist()\n" );
-  arr = transpose_array( arr );
-  arr = sort_array( arr, lambda( ({ 'x, 'y }),
-    ({ #'funcall, cl, ({ #'[, 'x, 0 }), ({ #'[, 'y, 0 }) }) ) );
-  arr = transpose_array( arr );
-  return arr;
+  perm = sort_permutation( arr[0], cl );
+  out = allocate( size );
+  for( i=0; i<size; i++ )
+    out[i] = apply_permutation( arr[i] + ({ }), perm );
+  return out;
 }
 
 /* affect the elements of an array through a closure */
@@ -581,3 +878,387 @@ acc_array( mixed elements, closure cl, mixed start, mixed args )
     map_array( elements, affect_cl, &start, args || ({ }), cl );
     return( start );
 }
+
+/*----------------------------- nth_element ------------------------------*/
+/*
+    Description:
+      Finds the element sort_array() would put at some index, without
+      sorting the whole array.
+    Parameters:
+      arr - an array
+      k   - the index wanted, counting from 0
+      cmp - a closure like sort_array()'s.  Defaults to #'>, which
+            gives the k'th lowest.
+    Returns:
+      sort_array(arr, cmp)[k]
+    Notes:
+      Quickselect on a copy of arr, so it takes time in proportion to
+      the size of arr, on average.  #'> and #'< are compared inline;
+      other closures are called for each comparison.
+*/
+
+// True if a belongs after b: dir is 1 for #'>, -1 for #'<, 0 for cmp.
+#define AFTER(a, b) \
+  ( dir > 0 ? (a) > (b) : ( dir < 0 ? (a) < (b) : funcall(cmp, a, b) ) )
+
+varargs mixed
+nth_element( mixed *arr, int k, closure cmp )
+{
+  mixed *a, pivot, tmp;
+  int lo, hi, i, j, dir;
+
+  if( k < 0 || k >= sizeof(arr) )
+    raise_error( "Bad argument 2 to nth_element()\n" );
+  if( !cmp || cmp == #'> )
+    dir = 1;
+  else if( cmp == #'< )
+    dir = -1;
+
+  a = arr + ({ });
+  hi = sizeof(a) - 1;
+  while( lo < hi )
+  {
+    pivot = a[lo + random(hi - lo + 1)];
+    i = lo;
+    j = hi;
+    while( i <= j )
+    {
+      while( AFTER(pivot, a[i]) )
+        i++;
+      while( AFTER(a[j], pivot) )
+        j--;
+      if( i <= j )
+      {
+        tmp = a[i];
+        a[i++] = a[j];
+        a[j--] = tmp;
+      }
+    }
+    // Everything in lo..j goes no later than anything in i..hi, and
+    // anything between them is the pivot.
+    if( k <= j )
+      hi = j;
+    else if( k >= i )
+      lo = i;
+    else
+      break;
+  }
+  return a[k];
+}
+
+#undef AFTER
+
+/*-------------------------------- top_k ---------------------------------*/
+/*
+    Description:
+      Finds the k elements of an array with the highest keys, without
+      sorting the whole array.
+    Parameters:
+      arr - an array
+      k   - how many elements are wanted
+      key - what to rank them by: a closure, called with each element;
+            a function name, called in each element; or 0 to rank the
+            elements themselves.
+    Returns:
+      Up to k elements of arr, highest key first.
+    Notes:
+      Keeps the best k seen so far in a heap, so it takes time in
+      proportion to the size of arr times log(k), and key is only
+      worked out once for each element.  Elements with equal keys come
+      out in no particular order.
+*/
+varargs mixed *
+top_k( mixed *arr, int k, mixed key )
+{
+  mixed *heap_keys, *heap, val, el;
+  int i, j, c, n, size;
+
+  if( k <= 0 )
+    return ({ });
+  size = sizeof(arr);
+  if( k > size )
+    k = size;
+  heap_keys = allocate(k);
+  heap = allocate(k);
+
+  for( i=0; i<size; i++ )
+  {
+    el = arr[i];
+    if( closurep(key) )
+      val = funcall(key, el);
+    else if( stringp(key) )
+      val = call_other(el, key);
+    else
+      val = el;
+
+    // A min-heap, so the lowest of the best k is on top.
+    if( n < k )
+    {
+      // Add it at the bottom and move it up.
+      for( j = n++; j > 0 && heap_keys[(j - 1) / 2] > val; j = (j - 1) / 2 )
+      {
+        heap_keys[j] = heap_keys[(j - 1) / 2];
+        heap[j] = heap[(j - 1) / 2];
+      }
+    }
+    else if( val > heap_keys[0] )
+    {
+      // Replace the top and move it down.
+      for( j = 0; (c = 2 * j + 1) < k; j = c )
+      {
+        if( c + 1 < k && heap_keys[c + 1] < heap_keys[c] )
+          c++;
+        if( !(heap_keys[c] < val) )
+          break;
+        heap_keys[j] = heap_keys[c];
+        heap[j] = heap[c];
+      }
+    }
+    else
+      continue;
+    heap_keys[j] = val;
+    heap[j] = el;
+  }
+
+  return apply_permutation( heap, sort_permutation( heap_keys, #'< ) );
+}
+
+/*------------------------------- min_max --------------------------------*/
+/*
+    Description:
+      Finds the lowest and highest elements of an array.
+    Parameters:
+      arr - an array of things that can be compared with < and >
+    Returns:
+      ({ lowest, highest }), or 0 if arr is empty.
+    Notes:
+      One pass, with no sorting.
+*/
+mixed *
+min_max( mixed *arr )
+{
+  mixed lo, hi;
+  int i, size;
+
+  if( !(size = sizeof(arr)) )
+    return 0;
+  lo = hi = arr[0];
+  for( i=1; i<size; i++ )
+  {
+    if( arr[i] < lo )
+      lo = arr[i];
+    else if( arr[i] > hi )
+      hi = arr[i];
+  }
+  return ({ lo, hi });
+}
+
+// Arrays being worked through by map_array_sliced() and
+// filter_array_sliced(), by handle.  Each call_out does elements until
+// it has used SJ_BUDGET eval cost, then leaves the rest for the next.
+#define SLICE_BUDGET  100000   // default eval cost per call_out
+
+#define SJ_ARRAY      0
+#define SJ_CLOSURE    1
+#define SJ_DONE       2   // called as (results, handle) at the end
+#define SJ_BUDGET     3
+#define SJ_FILTER     4   // true for filter_array_sliced()
+#define SJ_POS        5   // next element to do
+#define SJ_OUT        6   // results so far
+#define SJ_KEPT       7   // elements a filter has kept
+#define SJ_OWNER      8   // object that started it
+#define SJ_USER       9   // this_player() when it was started
+#define SJ_SLICES    10   // call_outs so far
+#define SJ_SIZE      11
+
+private static mapping slice_jobs;
+private static int slice_counter;
+
+/*
+** Do elements of job until the eval cost used since start is over
+** the job's budget.  At least one element is done each time, so a
+** tiny budget still gets there.
+*/
+private void
+slice_run( mixed *job, int start )
+{
+  mixed *arr, *out;
+  closure cl;
+  int pos, kept, size;
+
+  arr = job[SJ_ARRAY];
+  out = job[SJ_OUT];
+  cl = job[SJ_CLOSURE];
+  pos = job[SJ_POS];
+  kept = job[SJ_KEPT];
+  size = sizeof( arr );
+  while( pos < size )
+  {
+    if( !job[SJ_FILTER] )
+      out[pos] = funcall( cl, arr[pos] );
+    else if( funcall( cl, arr[pos] ) )
+      out[kept++] = arr[pos];
+    pos++;
+    if( start - get_eval_cost() >= job[SJ_BUDGET] )
+      break;
+  }
+  job[SJ_POS] = pos;
+  job[SJ_KEPT] = kept;
+}
+
+/*
+** The call_out.  Calls done with the results once every element has
+** been done, or as done(0, handle, error) if cl fails.
+*/
+static void
+array_slice( int handle )
+{
+  mixed *job;
+  string err;
+
+  if( !mappingp( slice_jobs ) || !( job = slice_jobs[handle] ) )
+    return;
+
+  job[SJ_SLICES]++;
+  if( err = catch( slice_run( job, get_eval_cost() ) ) )
+  {
+    m_delete( slice_jobs, handle );
+    funcall( job[SJ_DONE], 0, handle, err );
+    return;
+  }
+
+  if( job[SJ_POS] < sizeof( job[SJ_ARRAY] ) )
+  {
+    call_out( "array_slice", 0, handle );
+    return;
+  }
+
+  m_delete( slice_jobs, handle );
+  funcall( job[SJ_DONE],
+           job[SJ_FILTER] ? job[SJ_OUT][0..job[SJ_KEPT]-1] : job[SJ_OUT],
+           handle );
+}
+
+private int
+start_sliced( mixed *arr, closure cl, closure done, int budget,
+              status filter )
+{
+  mixed *job;
+
+  if( !pointerp( arr ) || !closurep( cl ) || !closurep( done ) )
+    return 0;
+  if( !mappingp( slice_jobs ) )
+    slice_jobs = ([ ]);
+
+  job = allocate( SJ_SIZE );
+  job[SJ_ARRAY]   = arr;
+  job[SJ_CLOSURE] = cl;
+  job[SJ_DONE]    = done;
+  job[SJ_BUDGET]  = ( budget > 0 ) ? budget : SLICE_BUDGET;
+  job[SJ_FILTER]  = filter;
+  job[SJ_OUT]     = allocate( sizeof( arr ) );
+  job[SJ_OWNER]   = previous_object() || this_object();
+  job[SJ_USER]    = this_player();
+
+  slice_jobs[++slice_counter] = job;
+  call_out( "array_slice", 0, slice_counter );
+  return slice_counter;
+}
+
+/*--------------------------- map_array_sliced ----------------------------*/
+/*
+    Description:
+      Same as map_array( arr, cl ), but done a bit at a time, for
+      arrays too big to map in one execution.
+    Parameters:
+      arr    - the array
+      cl     - called with each element
+      done   - called as done( results, handle ) when it's finished,
+               or as done( 0, handle, error ) if cl fails
+      budget - eval cost to use per call_out, or 0 for the default
+    Returns:
+      A handle for query_array_sliced() and cancel_array_sliced(), or
+      0 if arr, cl or done are the wrong type.
+    Notes:
+      The elements are done in call_outs from this object, so done is
+      never called before this returns, even for an empty array.
+*/
+varargs int
+map_array_sliced( mixed *arr, closure cl, closure done, int budget )
+{
+  return start_sliced( arr, cl, done, budget, 0 );
+}
+
+/*-------------------------- filter_array_sliced --------------------------*/
+/*
+    Description:
+      Same as filter_array( arr, cl ), but done a bit at a time.
+    Parameters:
+      Same as map_array_sliced().
+    Returns:
+      Same as map_array_sliced().
+    Notes:
+      done gets the elements cl was true for, in their original order.
+*/
+varargs int
+filter_array_sliced( mixed *arr, closure cl, closure done, int budget )
+{
+  return start_sliced( arr, cl, done, budget, 1 );
+}
+
+/*-------------------------- query_array_sliced ---------------------------*/
+/*
+    Description:
+      Tells how far along a sliced map or filter is.
+    Parameters:
+      handle - from map_array_sliced() or filter_array_sliced()
+    Returns:
+      0 if it's finished or cancelled, or a mapping of:
+        "position", "of" - elements done so far, and how many in all
+        "kept"           - elements a filter has kept so far
+        "slices"         - call_outs used so far
+    Notes:
+      None.
+*/
+mapping
+query_array_sliced( int handle )
+{
+  mixed *job;
+
+  if( !mappingp( slice_jobs ) || !( job = slice_jobs[handle] ) )
+    return 0;
+
+  return ([ "position" : job[SJ_POS],
+            "of"       : sizeof( job[SJ_ARRAY] ),
+            "kept"     : job[SJ_KEPT],
+            "slices"   : job[SJ_SLICES] ]);
+}
+
+/*-------------------------- cancel_array_sliced --------------------------*/
+/*
+    Description:
+      Gives up on a sliced map or filter.
+    Parameters:
+      handle - from map_array_sliced() or filter_array_sliced()
+    Returns:
+      1 if it was cancelled, 0 if there was no such job or it's
+      someone else's.
+    Notes:
+      done is not called.
+*/
+status
+cancel_array_sliced( int handle )
+{
+  mixed *job;
+
+  if( !mappingp( slice_jobs ) || !( job = slice_jobs[handle] ) )
+    return 0;
+
+  if( ( previous_object() != job[SJ_OWNER] )
+      && ( previous_object() != this_object() )
+      && ( this_player() != job[SJ_USER] ) )
+    return 0;
+
+  m_delete( slice_jobs, handle );
+  return 1;
+}
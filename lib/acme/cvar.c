@@ -4,6 +4,7 @@
     DESCRIPTION
         Chooses among various weighted options.
         choose_variant()        -chooses among different options
+        choose_variants()       -chooses several different ones
     NOTES
         choose_variant chooses from a 2D array of choice-chance pairs
     LAST MODIFIED
@@ -13,6 +14,9 @@
 
 #include <acme.h>
 #include AcmeCVarInc
+#include AcmeArrayInc
+
+private inherit AcmeArray;
 
 /*------------------------------ choose_variant -----------------------------*/
 /*
@@ -40,3 +44,40 @@ mixed choose_variant ( mixed *choices )
         rnum -= ( int ) choices[i][1];
     return 0;
 }
+
+/*------------------------------ choose_variants ----------------------------*/
+/*
+    description: chooses several different options, each weighted like
+                 choose_variant() does
+    parameters: choices   - ({ mixed option, int chance })
+                k         - how many options to choose
+    returns: mixed * (the options chosen, the first one chosen first)
+    notes: an option is never chosen twice, and options with no chance
+           are never chosen, so fewer than k may come back.  Gives each
+           option a random key based on its chance and keeps the k
+           best with top_k(), so it only needs room for k options.
+*/
+private float variant_key ( mixed *choice )
+{
+    float u;
+    if ( ( int ) choice[1] <= 0 )
+        return -1.0e30;
+    // log(u) / chance for u in (0, 1]: bigger chances give keys nearer 0.
+    u = to_float ( random ( 1000000 ) + 1 ) / 1000000.0;
+    return log ( u ) / to_float ( choice[1] );
+}
+
+mixed *choose_variants ( mixed *choices, int k )
+{
+    int i;
+    int size;    // size of choices
+    int live;    // how many have a chance at all
+
+    size = sizeof ( choices );
+    for ( i = 0; i < size; i++ )
+        if ( ( int ) choices[i][1] > 0 )
+            live++;
+    if ( k > live )
+        k = live;
+    return map_array ( top_k ( choices, k, #'variant_key ), #'[, 0 );
+}
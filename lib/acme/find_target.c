@@ -6,6 +6,7 @@
         find_targets()     - Find object[s] according to some priorities
         find_target()      - Same thing, but only returns one object.
         find_inherit()     - find all the objects that inherit a target file
+        flush_target_cache() - forget what quiet find_targets() calls found
 
         The priority string used by find_target() and find_targets()
         is a string of the characters defined in AcmeFindTargetInc.
@@ -15,7 +16,10 @@
         Use whichever you find more readable.
 
     NOTES
-        None.
+        Quiet find_targets() calls remember what they found (or that
+        they found nothing) for TARGET_CACHE_TTL seconds, per player,
+        for as long as the player stays in the same room, and until
+        anybody calls flush_target_cache() for them.
     LAST MODIFIED
         Devo 980109
 */
@@ -35,6 +39,23 @@ inherit AcmeStrings;
 #include AcmeStringsInc
 #include AcmeFindTargetInc
 
+// What quiet find_targets() calls turned up, so that a typo in a command
+// tool doesn't go to the disk on every keystroke.  Keyed by THISP, then
+// by priorities + "\n" + spec.  Misses are kept too, as ({ }).
+#define TARGET_CACHE_TTL   2    // seconds a result is good for
+#define TARGET_CACHE_SIZE  32   // results kept per player
+
+#define TC_ROOM     0   // ENV(THISP) when the results were found
+#define TC_TIME     1   // time() the oldest of them was found
+#define TC_RESULTS  2   // key : objects
+#define TC_STAMP    3   // AcmeTargetFlush's stamp for THISP then
+#define TC_SIZE     4
+
+private static mapping target_cache;
+
+private object *find_targets_uncached( string spec, string priorities,
+                                       status quiet );
+
 /*----------------------------- resolve_filespec ---------------------------*/
 /*
     Description:
@@ -97,6 +118,91 @@ resolve_filespec( string arg, status quiet )
 }
 
 
+/*----------------------------- cached_targets ---------------------------*/
+/*
+    Description:
+      Looks up a find_targets() result in the cache.
+    Parameters:
+      key - priorities + "\n" + spec
+    Returns:
+      The objects, ({ }) for a remembered miss, or 0 if there's
+      nothing usable in the cache.
+    Notes:
+      Drops THISP's entry if they've moved, it has gone stale, or
+      somebody has flushed it since.
+*/
+private object *
+cached_targets( string key )
+{
+  mixed *entry;
+  object *obs;
+
+  if( !mappingp( target_cache ) || !( entry = target_cache[THISP] ) )
+    return 0;
+  if( ( entry[TC_ROOM] != ENV(THISP) )
+      || ( time() - entry[TC_TIME] > TARGET_CACHE_TTL )
+      || ( entry[TC_STAMP] != AcmeTargetFlush->query_stamp( THISP ) ) )
+  {
+    m_delete( target_cache, THISP );
+    return 0;
+  }
+  if( !( obs = entry[TC_RESULTS][key] ) )
+    return 0;
+
+  // Something it found has been destructed, so look again.
+  if( sizeof( obs ) && ( member( obs, 0 ) != -1 ) )
+    return 0;
+  return obs + ({ });
+}
+
+private void
+cache_targets( string key, object *obs )
+{
+  mixed *entry;
+
+  if( !mappingp( target_cache ) )
+    target_cache = ([ ]);
+  entry = target_cache[THISP];
+  if( !entry || ( sizeof( entry[TC_RESULTS] ) >= TARGET_CACHE_SIZE ) )
+  {
+    // Dead players fall out of the mapping on their own.
+    entry = allocate( TC_SIZE );
+    entry[TC_ROOM] = ENV(THISP);
+    entry[TC_TIME] = time();
+    entry[TC_RESULTS] = ([ ]);
+    entry[TC_STAMP] = AcmeTargetFlush->query_stamp( THISP );
+    target_cache[THISP] = entry;
+  }
+  entry[TC_RESULTS][key] = obs + ({ });
+}
+
+/*-------------------------- flush_target_cache ---------------------------*/
+/*
+    Description:
+      Forgets what quiet find_targets() calls have found.
+    Parameters:
+      who - Only forget what was found for this player (optional)
+    Returns:
+      Nothing.
+    Notes:
+      The cache notices when a player moves, and nothing in it is more
+      than TARGET_CACHE_TTL seconds old, but it can't see files being
+      written.  Tools that write or remove files should call this if
+      the next command might want to find what they wrote.
+      Every object that inherits this has its own cache.  This goes
+      through AcmeTargetFlush, so the others (the ospec engine's
+      included) are flushed too.
+*/
+varargs void
+flush_target_cache( object who )
+{
+  AcmeTargetFlush->flush( who );
+  if( !who )
+    target_cache = ([ ]);
+  else if( mappingp( target_cache ) )
+    m_delete( target_cache, who );
+}
+
 /*----------------------------- find_targets ---------------------------*/
 /*
     Description:
@@ -114,17 +220,37 @@ resolve_filespec( string arg, status quiet )
       Side effects: May call id() in many objects.
       prev is not used for anything, but is there so that anything
       that overrides this function can choose to use it.
+      Quiet calls are cached; see flush_target_cache().  Loud ones
+      aren't, so that they still print their error messages.
 */
 varargs object *
 find_targets(string spec, string priorities, status quiet, object *prev )
 {
-  object ob;
   object *obs;
-  int i, len;
-  
+  string key;
+
   if( !stringp( spec ) || !stringp( priorities ) )
     return 0;
-  
+
+  if( !quiet || !THISP )
+    return find_targets_uncached( spec, priorities, quiet );
+
+  key = priorities + "\n" + spec;
+  if( obs = cached_targets( key ) )
+    return obs;
+  obs = find_targets_uncached( spec, priorities, quiet );
+  if( obs )
+    cache_targets( key, obs );
+  return obs;
+}
+
+private object *
+find_targets_uncached( string spec, string priorities, status quiet )
+{
+  object ob;
+  object *obs;
+  int i, len;
+
   for( len = strlen( priorities ); i < len; i++ )
   {
     switch ( priorities[i] )
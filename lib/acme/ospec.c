@@ -7,12 +7,39 @@
       object_spec_variable_set() - sets a variable for use in specs
       object_spec_help()         - returns name of help file
       evaluate_object_spec()     - parses spec and return list of objects
+      evaluate_object_specs()    - parses a batch of specs
 
       parse_ospec()              - Same thing, but not Opie conformant
+      parse_ospecs()             - Same thing, but not Opie conformant
+      flush_ospec_plans()        - forget all compiled specs
+      flush_mapfile_cache()      - forget what mapfile. terms have read
+      register_ospec_operator()  - add to (or remove from) the syntax
+                                   (static, for the inheriting engine)
+      set_ospec_impure()         - mark a function as unsafe to memoize
+                                   (static, for the inheriting engine)
+
+      profile_object_spec()      - evaluate a spec and time every term
+      profile_ospec()            - Same thing, but not Opie conformant
+
+      set(), query()             - VarSpace, plus the result history
+      parse_ospec_async()        - evaluate a spec a bit at a time
+      query_ospec_async()        - how far along it is
+      cancel_ospec_async()       - give up on it
+
+     Both evaluate_object_spec() and parse_ospec() take an optional
+     limit on the number of objects wanted.  See run_subspec().
 
     NOTES
         The only side effects are in the VarSpace code.
-        Other than that, this object is stateless.
+
+        Specs are compiled into plans before they are evaluated.  A
+        plan is an array with one entry per subspec, and each of those
+        is an array of steps, one per term.  A step holds the operator
+        closure that matched the term and the argument it should be
+        called with, so evaluating a plan does no string parsing or
+        lambda construction.  The most recently used plans are cached,
+        keyed by the spec and its priorities.  Other than that cache,
+        this object is stateless.
     LAST MODIFIED
         Devo 971218
 
@@ -84,8 +111,130 @@ mapping exact_matches, // when the entire item matches a literal string
                          ({ CL_OPEN_BRACKET, ({ #'cl }), key }), 'arg }) })
 
 
-// Make sure these are set right or your longer prefixes won't get checked.
-int max_len_string_prefix;
+// Every token in the four tables above, one character per level.  A
+// node maps the next character to the node below it, and maps the
+// name of each table that has the token spelled so far to 1.  See
+// match_operator() and register_ospec_operator().
+static mapping op_trie;
+
+// kind : ([ token : 1 ]) for the operators make_closures() set up.
+// register_ospec_operator() won't replace or remove these.
+static mapping builtin_ops;
+
+#define OP_KINDS ({ "exact_matches", "number_prefix", "string_prefix", \
+                    "normal_op" })
+
+// The closures of the +, != and == prefixes, and which is which.
+// compile_subspec() turns each run of them into a single step.
+static mapping set_op_names;
+
+// Normal ops which can do some of their work when the spec is compiled.
+// Each closure takes the exploded term and returns ({ closure, arg })
+// for the step, or 0 to fall back on the entry in normal_op.
+mapping op_compilers;
+
+
+// The layout of a compiled step.  See make_step().
+#define STEP_CL        0   // called as (prev, arg, first, priorities)
+#define STEP_ARG       1   // whatever the term compiled down to
+#define STEP_KIND      2   // which table or rule matched the term
+#define STEP_TERM      3   // the text of the term
+#define STEP_STREAM    4   // per-object form of STEP_CL, or 0.  See below.
+#define STEP_SIZE      5
+
+// Terms that work on each object in the list independently of the
+// others can be evaluated one object at a time.  Their steps get a
+// stream closure, called as (ob, arg), which returns the object or
+// objects that the single object <ob> turns into.  Stream closures are
+// kept in stream_ops[kind][token], parallel to the operator tables.
+mapping stream_ops;
+
+// Stand-in for a stream closure: walk deep_inventory() lazily.
+#define LAZY_DEEP      "deep_inventory"
+
+#define PLAN_CACHE_SIZE 64
+
+static mapping plan_cache;  // priorities + "\n" + spec : ({ plan, stamp })
+static int plan_clock;      // last stamp handed out
+
+// What mapfile. terms turned each line of their file into, so the file
+// doesn't have to be read and resolved every time.  Keyed by
+// file + "\n" + function + "\n" + dataspace.  See spec_mapfile().
+#define MAPFILE_CACHE_SIZE 32
+#define MAPFILE_OSPEC_TTL  10   // seconds an OSPEC line's objects are good
+#define MAPFILE_RETRY       5   // seconds before retrying lines that missed
+
+#define MF_MTIME     0   // modification time of the file when read
+#define MF_LINES     1   // the lines of the file
+#define MF_RESULTS   2   // what each line resolved to
+#define MF_RETRIED   3   // time() the missing lines were last retried
+#define MF_FRESH     4   // time() every line was last resolved
+#define MF_USED      5   // time() the entry was last used
+#define MF_SIZE      6
+
+static mapping mapfile_cache;
+
+// Specs being evaluated by parse_ospec_async(), by handle.  Each one
+// is an array laid out as below, and is worked on by async_slice() in
+// a call_out until it's done.
+#define ASYNC_BUDGET   200000  // default eval cost per slice
+
+#define AJ_PLAN        0   // the compiled spec
+#define AJ_PRIORITIES  1
+#define AJ_CALLBACK    2   // called as (objects, handle) when done
+#define AJ_OWNER       3   // object that started it
+#define AJ_USER        4   // THISP when it was started
+#define AJ_BUDGET      5   // eval cost to use per slice
+#define AJ_SUBSPEC     6   // index of the subspec being run
+#define AJ_STEP        7   // index of the step being run
+#define AJ_PREV        8   // list the step is working on
+#define AJ_FIRST       9   // whether it's the first step
+#define AJ_POS        10   // how much of AJ_PREV a streamed step has done
+#define AJ_OUT        11   // what a streamed step made, per object of AJ_PREV
+#define AJ_LIST       12   // results of the finished subspecs
+#define AJ_SLICES     13   // number of call_outs so far
+#define AJ_SIZE       14
+
+static mapping async_jobs;
+static int async_counter;
+
+// The last HISTORY_SIZE results of each dataspace, for $$, $1..$N and
+// the pronouns.  Pronouns are only worked out when someone asks for
+// one (or when a result falls off the end of the ring), so most specs
+// never call query_gender().  See record_result() and query().
+#define HISTORY_SIZE  16
+
+#define H_LISTS       0   // ring of results
+#define H_STAMPS      1   // history_clock when each was recorded
+#define H_KINDS       2   // pronoun each one is, once it's been worked out
+#define H_NEXT        3   // slot the next result goes in
+#define H_COUNT       4   // how many slots are full
+#define H_SIZE        5
+
+static mapping history;      // dataspace : ({ H_* })
+static mapping var_stamps;   // dataspace : ([ variable : stamp ])
+static int history_clock;
+
+#define PRONOUNS ({ "him", "her", "it", "them" })
+
+// If a user sets the variable "memo", each ->func() and #'efun in their
+// filters and sorts is only called once per object and arguments
+// during a top-level parse_ospec().  memo holds the results while that
+// call is running, and is 0 the rest of the time.  See memo_call().
+static mapping memo;             // ob : ([ func and args : result ])
+static int memo_depth;           // how many parse_ospec()s deep we are
+static mapping impure_functions; // name : 1 for things never memoized
+
+#define IMPURE_FUNCTIONS ({ "random", "time", "utime", "get_eval_cost", \
+                            "call_out", "remove", "move", "destruct", \
+                            "move_object", "tell_object", "write" })
+#define IMPURE_PREFIXES  ({ "set_", "add_", "do_" })
+
+// While profile_ospec() is running, run_subspec() appends one mapping
+// per step to profile_rows.  See profile_ospec() for what's in them.
+static mixed *profile_rows;
+static int profile_depth;    // how deeply nested the current spec is
+static int profile_subspec;  // which subspec of it is running
 
 
 #define DATASPACE ( getuid(THISP||THISO) )
@@ -102,6 +251,17 @@ int max_len_string_prefix;
 static closure make_filter_closure( string *args );
 static string *explode_argspec( string argspec );
 static mixed value_closure( string arg );
+static mixed *compile_ospec( string ospec );
+static mixed *compile_subspec( string ospec );
+static object *run_plan( mixed *plan, object *prev, string priorities,
+                         int limit );
+static status pull_deep( object ob, mixed *chain, int k, object *out,
+                         int count );
+static object *record_result( object *list );
+static object *set_union( mixed *lists );
+static mixed *compile_filter( string *args );
+static mixed *compile_sort( string *args );
+static mixed *query_ospec_plan( string ospec, string priorities );
 
 
 
@@ -129,6 +289,78 @@ spec_rooms( object *prev, string *args, status first )
   return force_load_array(map_array(prev, #'get_exit, args[1]));
 }
 
+// The results of one mapfile. line that are still any good, or 0.
+static mixed
+mapfile_alive( mixed result )
+{
+  if( pointerp( result ) )
+    return sizeof( result = filter_array( result, #'objectp ) ) ? result : 0;
+  return objectp( result ) ? result : 0;
+}
+
+// Finds (or makes) the cache entry for a mapfile and brings its
+// results up to date.  Lines whose objects have been destructed are
+// resolved again right away, and lines that didn't resolve to anything
+// are retried every MAPFILE_RETRY seconds.
+static mixed *
+mapfile_entry( string file, string func, closure resolver, status force )
+{
+  string key, *keys;
+  mixed *entry, *results, *dates, was;
+  int i, size, oldest;
+  status retry;
+
+  dates = get_dir( file, 4 );
+  key = file + "\n" + func + "\n" + DATASPACE;
+  entry = mapfile_cache[key];
+
+  if( force || !entry || !pointerp( dates ) || !sizeof( dates )
+      || ( entry[MF_MTIME] != dates[0] ) )
+  {
+    if( !entry && ( sizeof( mapfile_cache ) >= MAPFILE_CACHE_SIZE ) )
+    {
+      // Throw out the one that was used longest ago.
+      keys = m_indices( mapfile_cache );
+      for( oldest = 0, i = 1, size = sizeof( keys ); i < size; i++ )
+        if( mapfile_cache[keys[i]][MF_USED]
+            < mapfile_cache[keys[oldest]][MF_USED] )
+          oldest = i;
+      m_delete( mapfile_cache, keys[oldest] );
+    }
+    entry = allocate( MF_SIZE );
+    entry[MF_MTIME] = ( pointerp( dates ) && sizeof( dates ) ) ? dates[0] : 0;
+    entry[MF_LINES] = grab_file( file ) || ({ });
+    entry[MF_RESULTS] = allocate( sizeof( entry[MF_LINES] ) );
+    mapfile_cache[key] = entry;
+  }
+
+  // Ospecs depend on where everyone is, so they don't keep for long.
+  if( ( func == "OSPEC" )
+      && ( time() - entry[MF_FRESH] > MAPFILE_OSPEC_TTL ) )
+  {
+    entry[MF_RESULTS] = allocate( sizeof( entry[MF_LINES] ) );
+    entry[MF_FRESH] = entry[MF_RETRIED] = 0;
+  }
+
+  if( retry = ( time() - entry[MF_RETRIED] >= MAPFILE_RETRY ) )
+  {
+    if( !entry[MF_RETRIED] )
+      entry[MF_FRESH] = time();
+    entry[MF_RETRIED] = time();
+  }
+
+  results = entry[MF_RESULTS];
+  for( i=0, size = sizeof( results ); i < size; i++ )
+  {
+    was = results[i];
+    if( !( results[i] = mapfile_alive( was ) ) && ( was || retry ) )
+      results[i] = funcall( resolver, entry[MF_LINES][i] );
+  }
+
+  entry[MF_USED] = time();
+  return entry;
+}
+
 object *
 spec_mapfile( object *prev, string *args, status first )
 {
@@ -141,29 +373,52 @@ spec_mapfile( object *prev, string *args, status first )
     return ({ });
   }
 
-  lines = grab_file( file );
   switch ( args[2] )
   {
     case "FILTER":  // special case so people can insert filters
       if ( !first )
       {
+        // Depends on prev, so it can't be cached.
+        lines = grab_file( file );
         mapped = map_array( lines, #'parse_ospec, prev );
         break;
       } // else, act like OSPEC
     case "OSPEC":   // special case so people can give ospecs
-      mapped = map_array( lines, #'parse_ospec );
+      mapped = mapfile_entry( file, "OSPEC", #'parse_ospec,
+                              args[0] == "mapfile!" )[MF_RESULTS];
       break;
     default:
-      mapped = map_array( lines, symbol_function( args[2] ) );
+      mapped = mapfile_entry( file, args[2], symbol_function( args[2] ),
+                              args[0] == "mapfile!" )[MF_RESULTS];
   }
 
-  mapped = flatten_array1( mapped );   // make sure it's not an array of arrays
+  // make sure it's not an array of arrays, or full of dead objects
+  mapped = filter_array( flatten_array1( mapped ), #'objectp );
 
   if ( first )
     return mapped;
   return intersect_array( prev, mapped );
 }
 
+/*----------------------------- flush_mapfile_cache ---------------------------*/
+/*
+    Description:
+      Forgets everything that mapfile. terms have read.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      The cache notices when a file changes, so this is only needed
+      if something a mapfile. line resolves to changes in a way the
+      cache can't see.  "mapfile!" does the same for a single file.
+*/
+void
+flush_mapfile_cache()
+{
+  mapfile_cache = ([ ]);
+}
+
 object *
 spec_filter_closure( object *prev, string *args )
 {
@@ -172,37 +427,123 @@ spec_filter_closure( object *prev, string *args )
   return closurep(tmpcl) ? filter_array(prev, tmpcl, prev) : ({ });
 }
 
-static closure
-sort_cl( status high_to_low, closure val )
+// Comparators for sort_keys().  Each element is ({ key, ..., index }).
+// The index breaks ties, so objects with equal keys keep their order.
+static status
+keys_after( mixed *a, mixed *b )
+{
+  int i, size;
+
+  for( i=0, size=sizeof(a)-1; i < size; i++ )
+    if( a[i] != b[i] )
+      return a[i] > b[i];
+  return a[size] > b[size];
+}
+
+static status
+keys_after_desc( mixed *a, mixed *b )
+{
+  int i, size;
+
+  for( i=0, size=sizeof(a)-1; i < size; i++ )
+    if( a[i] != b[i] )
+      return a[i] < b[i];
+  return a[size] > b[size];
+}
+
+// The closures that give the sort keys of a sort. or sort-. term.
+// "sort.->query_level" and "sort.>.->query_hp().50" have one key, like
+// f.; "sort.->query_level.->query_name" has one per value.
+static closure *
+make_sort_keys( string *args )
 {
-  return lambda( ({ 'a, 'b }),
-                 ({ high_to_low ? #'< : #'> ,
-                      ({ #'funcall, val, 'a }),
-                      ({ #'funcall, val, 'b }) }));
+  closure *keys;
+  int i, size;
+
+  if( ( sizeof( args ) > 2 )
+      && ( member( ({ "!", ">", "<", ">=", "<=", "?", "?:", "==", "!=" }),
+                   args[1] ) < 0 ) )
+  {
+    keys = allocate( size = sizeof( args ) - 1 );
+    for( i=0; i < size; i++ )
+      if( !closurep( keys[i] = make_filter_closure( args[i+1..i+1] ) ) )
+        return 0;
+    return keys;
+  }
+
+  return closurep( keys = make_filter_closure( args[1..] ) ) ? ({ keys }) : 0;
+}
+
+object *
+sort_keys( object *prev, closure *keys, status high_to_low )
+{
+  mixed *dec, row;
+  object *out;
+  int i, j, size, nkeys;
+
+  if( !pointerp( keys ) )
+    return ({ });
+
+  // Work out every object's keys once, rather than twice per comparison.
+  nkeys = sizeof( keys );
+  dec = allocate( size = sizeof( prev ) );
+  for( i=0; i < size; i++ )
+  {
+    row = allocate( nkeys + 1 );
+    for( j=0; j < nkeys; j++ )
+      row[j] = funcall( keys[j], prev[i], prev );
+    row[nkeys] = i;
+    dec[i] = row;
+  }
+
+  dec = sort_array( dec, high_to_low ? #'keys_after_desc : #'keys_after );
+
+  out = allocate( size );
+  for( i=0; i < size; i++ )
+    out[i] = prev[ dec[i][nkeys] ];
+  return out;
 }
 
 object *
 spec_sort_closure( object *prev, string *args )
 {
-  closure tmpcl;
-  tmpcl = make_filter_closure(args[1..]);
-  return closurep(tmpcl) ? sort_array(prev, sort_cl(1, tmpcl)) : ({ });
+  return sort_keys( prev, make_sort_keys( args ), 1 );
 }
 
 object *
 spec_revsort_closure( object *prev, string *args )
 {
-  closure tmpcl;
-  tmpcl = make_filter_closure(args[1..]);
-  return closurep(tmpcl) ? sort_array(prev, sort_cl(0, tmpcl)) : ({ });
+  return sort_keys( prev, make_sort_keys( args ), 0 );
+}
+
+object *
+spec_filter_compiled( object *prev, closure tmpcl )
+{
+  return closurep(tmpcl) ? filter_array(prev, tmpcl, prev) : ({ });
+}
+
+object *
+spec_sort_compiled( object *prev, mixed *sorter )
+{
+  return sort_keys( prev, sorter[0], sorter[1] );
 }
 
 object *
 spec_ip( object *prev, string *args, status first )
 {
-  if(first)
-    prev = users();
-  return filter_by_hostname(prev, implode(args[1..], ".") );
+  // For ip..domain with no list yet, the user index does the work.
+  return filter_by_hostname(first ? 0 : prev, implode(args[1..], ".") );
+}
+
+object *
+spec_clones( object *prev, string *args, status first )
+{
+  object *obs;
+
+  // The file name may have had its ".c" split off as another argument.
+  obs = AcmeCloneIndex->query_clones( expand_path( implode( args[1..], "." ),
+                                                   THISP ) );
+  return first ? obs : intersect_array( prev, obs );
 }
 
 object *
@@ -210,15 +551,148 @@ spec_level( object *prev, string *args, status first )
 {
   int itmp, itmp2;
 
-  if( first )
-    prev = users();
-
   itmp = to_ordlevel(args[1]);
   if( sizeof(args) > 2 )
     itmp2 = to_ordlevel(args[2]);
   else
     itmp2 = itmp;
-  return level_range(prev, itmp, itmp2);
+
+  // All users of those levels come straight from the user index.
+  return level_range(first ? 0 : prev, itmp, itmp2);
+}
+
+/*----------------------------- memo_get ---------------------------*/
+/*
+    Description:
+      Looks up a memoized call, for memo_call()'s closures.
+    Parameters:
+      ob  - the object called
+      key - the function and arguments
+    Returns:
+      ({ result }) if it's been called already during this spec, else 0.
+    Notes:
+      Does nothing when no memoized spec is running.
+*/
+private mixed *
+memo_get( object ob, string key )
+{
+  if( !memo || !mappingp( memo[ob] ) || !member( memo[ob], key ) )
+    return 0;
+  return ({ memo[ob][key] });
+}
+
+/*----------------------------- memo_put ---------------------------*/
+/*
+    Description:
+      Remembers a call, for memo_call()'s closures.
+    Parameters:
+      ob     - the object called
+      key    - the function and arguments
+      result - what it returned
+    Returns:
+      result
+    Notes:
+      Does nothing when no memoized spec is running.
+*/
+private mixed
+memo_put( object ob, string key, mixed result )
+{
+  if( memo )
+  {
+    if( !mappingp( memo[ob] ) )
+      memo[ob] = ([ ]);
+    memo[ob][key] = result;
+  }
+  return result;
+}
+
+/*----------------------------- set_ospec_impure ---------------------------*/
+/*
+    Description:
+      Marks a function as one whose results mustn't be memoized.
+    Parameters:
+      name - an lfun or efun name
+      flag - 1 if it's impure, 0 to take that back
+    Returns:
+      Nothing.
+    Notes:
+      Functions named in IMPURE_FUNCTIONS or starting with one of
+      IMPURE_PREFIXES start out impure.  Compiled specs are thrown
+      out, since they may have memoized the function.  Static, so
+      only the engine inheriting this can change what it memoizes.
+*/
+static varargs void
+set_ospec_impure( string name, status flag )
+{
+  if( flag )
+    impure_functions[name] = 1;
+  else
+    impure_functions[name] = 0;  // overrides IMPURE_PREFIXES too
+  flush_ospec_plans();
+}
+
+static status
+impure( string name )
+{
+  int i, size;
+  string *prefixes;
+
+  // #'efuns are memoized as "#'name", but impure under their name.
+  if( name[0..1] == "#'" )
+    name = name[2..];
+  if( member( impure_functions, name ) )
+    return impure_functions[name];
+  for( prefixes = IMPURE_PREFIXES, i=0, size=sizeof(prefixes); i < size; i++ )
+    if( name[0..strlen(prefixes[i])-1] == prefixes[i] )
+      return 1;
+  return 0;
+}
+
+/*----------------------------- memo_call ---------------------------*/
+/*
+    Description:
+      Builds the closure code to call a function in 'thiso, memoized
+      if memoizing is turned on.
+    Parameters:
+      func - an lfun name, or a closure to funcall with 'thiso
+      name - the lfun or efun name
+      args - closure code for the arguments, or 0 for none
+    Returns:
+      Closure code.
+    Notes:
+      Memoized calls keep their arguments in the lambda local 'ma and
+      what memo_get() returned in 'mv.  Arguments are only evaluated
+      once either way.
+*/
+static mixed
+memo_call( mixed func, string name, mixed *args )
+{
+  mixed call, key;
+
+  if( closurep( func ) )
+    call = ({ #'funcall, func, 'thiso });
+  else if( args )
+    call = ({ #'apply, #'call_other, 'thiso, func, 'ma });
+  else
+    call = ({ #'call_other, 'thiso, func });
+
+  if( !memo || impure( name ) )
+  {
+    if( args && !closurep( func ) )
+      return ({ #'funcall, #'call_other, 'thiso, func }) + args;
+    return call;
+  }
+
+  key = args ? ({ #'sprintf, "%s%O", name, 'ma }) : name;
+  call = ({ #',,
+            ({ #'=, 'mv, ({ #'memo_get, 'thiso, key }) }),
+            ({ #'?, 'mv,
+                    ({ CL_OPEN_BRACKET, 'mv, 0 }),
+                    ({ #'memo_put, 'thiso, key, call })
+            }) });
+  if( args && !closurep( func ) )
+    call = ({ #',, ({ #'=, 'ma, ({ #'({ }) + args }), call });
+  return call;
 }
 
 mixed
@@ -232,18 +706,18 @@ spec_funcall_cl( string arg )
 
   first_open = member( arg, '\(' );
   if( -1 == first_open )
-    return ({ #'call_other, 'thiso, arg });
+    return memo_call( arg, arg, 0 );
 
   argspec = arg[ searcha_str_unescaped( arg, '\(') + 1
                ..searcha_str_unescaped( arg, '\)', strlen(arg)-1, -1) - 1];
   funcname = arg[0..member( arg, '\(' )-1 ];
 
   if( argspec == "" )
-    return ({ #'call_other, 'thiso, funcname });
+    return memo_call( funcname, funcname, 0 );
 
   args = map_array( explode_argspec( argspec ), #'value_closure );
   return args
-    ? ( ({ #'apply, #'call_other, 'thiso, funcname }) + args )
+    ? memo_call( funcname, funcname, args )
     : 0; // there was some kind of error.
 }
 
@@ -262,58 +736,392 @@ spec_funcall( object *prev, string arg )
   return map_array( prev, cl, prev );
 }
 
+object *
+spec_nested( object *prev, mixed *plan, status first, string priorities )
+{
+  object *list;
+  int subspec;
+
+  if( profile_rows )
+  {
+    subspec = profile_subspec;
+    profile_depth++;
+    list = run_plan(plan, 0, priorities, 0);
+    profile_depth--;
+    profile_subspec = subspec;
+    return record_result(list);
+  }
 
+  return record_result( run_plan( plan, 0, priorities, 0 ) );
+}
 
-/*----------------------------- make_closures ---------------------------*/
+object *
+spec_set_ops( object *prev, mixed *ops, status first, string priorities )
+{
+  mapping pos, other;
+  mixed *lists;
+  object *order, *obs, *keys;
+  int i, j, k, size, len;
+
+  // The terms' specs don't depend on the list, so get them all first
+  // and make room for everything that could ever be in the set.
+  lists = allocate( size = sizeof(ops) );
+  for( len = sizeof(prev), i=0; i < size; i++ )
+  {
+    lists[i] = parse_ospec( ops[i][1], 0, priorities ) || ({ });
+    if( ops[i][0] == "+" )
+      len += sizeof( lists[i] );
+  }
+
+  // order holds the set in the order things joined it, with 0 where
+  // something has since been taken out; pos maps what's in the set
+  // now to where it is in order.
+  order = allocate( len );
+  pos = ([ ]);
+  for( j=0, len=sizeof(prev); j < len; j++ )
+    if( objectp( prev[j] ) && !member( pos, prev[j] ) )
+      order[ pos[prev[j]] = k++ ] = prev[j];
+
+  for( i=0; i < size; i++ )
+  {
+    obs = lists[i];
+    switch( ops[i][0] )
+    {
+      case "+":
+        for( j=0, len=sizeof(obs); j < len; j++ )
+          if( objectp( obs[j] ) && !member( pos, obs[j] ) )
+            order[ pos[obs[j]] = k++ ] = obs[j];
+        break;
+      case "!=":
+        for( j=0, len=sizeof(obs); j < len; j++ )
+          if( member( pos, obs[j] ) )
+          {
+            order[ pos[obs[j]] ] = 0;
+            m_delete( pos, obs[j] );
+          }
+        break;
+      case "==":
+        other = ([ ]);
+        for( j=0, len=sizeof(obs); j < len; j++ )
+          if( member( pos, obs[j] ) )
+            other[obs[j]] = pos[obs[j]];
+        for( keys = m_indices( pos ), j=0, len=sizeof(keys); j < len; j++ )
+          if( !member( other, keys[j] ) )
+            order[ pos[keys[j]] ] = 0;
+        pos = other;
+        break;
+    }
+  }
+
+  return filter_array( order[0..k-1], #'objectp );
+}
+
+object *
+spec_item( object *prev, int i )
+{
+  return ({ checked_item( prev, i ) });
+}
+
+object *
+spec_range( object *prev, int *range )
+{
+  if( range[2] )
+    return prev[range[0]..<range[1]];
+  return prev[range[0]..range[1]];
+}
+
+object *
+spec_file( object *prev, string arg )
+{
+  return resolve_filespec( arg, 1 );
+}
+
+object *
+spec_dwim( object *prev, string arg, status first, string priorities )
+{
+  if( !first )
+    return map_array(prev, cl["present"], arg);
+
+  /* The DWIM last resort */
+  return find_targets( arg, priorities, 1, prev );
+}
+
+
+
+/*----------------------------- trie_insert ---------------------------*/
 /*
     Description:
-      Binds some closures for convenient use in ospec transforms.
+      Adds a token to op_trie.
     Parameters:
-      None.
+      kind  - which table the token is in
+      token - the token
     Returns:
       Nothing.
     Notes:
       None.
 */
 static void
-make_closures()
+trie_insert( string kind, string token )
 {
-  cl = ([ ]);
-  exact_matches = ([ ]);
-  string_prefix = ([ ]);
-  number_prefix = ([ ]);
-  normal_op = ([ ]);
-
-  cl["shad_1"] = lambda( ({ 'o, 'i }),
-                        ({ #'checked_item,
-			   ({ #'all_shadows, 'o }), 'i }));
-  cl["shad_1_rev"] = lambda( ({ 'o, 'i }),
-                        ({ #'checked_item_reverse,
-                           ({ #'all_shadows, 'o }), 'i }));
-  cl["invnum"] = lambda( ({ 'o, 'i }),
-                         ({ #'checked_item,
-		           ({ #'all_inventory, 'o }), 'i }));
+  mapping node;
+  int i, size;
 
-  cl["progname"] = lambda( ({ 'o, 'pn }),
-                           ({ #'== , ({ #'load_name, 'o }), 'pn }));
+  node = op_trie;
+  for( i=0, size=strlen(token); i < size; i++ )
+  {
+    if( !mappingp( node[token[i]] ) )
+      node[token[i]] = ([ ]);
+    node = node[token[i]];
+  }
+  node[kind] = 1;
+}
 
-  cl["present"] = lambda( ({ 'o, 'arg }),
-                          ({ #'present, 'arg, 'o }) );
+/*----------------------------- trie_remove ---------------------------*/
+/*
+    Description:
+      Takes a token out of op_trie.
+    Parameters:
+      kind  - which table the token was in
+      token - the token
+    Returns:
+      Nothing.
+    Notes:
+      Empty nodes are left in place; they do no harm.
+*/
+static void
+trie_remove( string kind, string token )
+{
+  mapping node;
+  int i, size;
+
+  node = op_trie;
+  for( i=0, size=strlen(token); i < size; i++ )
+    if( !mappingp( node = node[token[i]] ) )
+      return;
+  m_delete( node, kind );
+}
 
-  exact_matches["me"] = lambda(0, ({ #'this_player }) );
-  exact_matches["here"] = lambda( 0, ({ #'environment, ({ #'this_player }) }));
-  exact_matches["it"] = exact_matches["him"] =
-    exact_matches["her"] = exact_matches["them"] =
-    lambda( ({ 'prev, 'arg, 'first }),
-            ({ #'query, 'arg, DATASPACE_CL }) );
+/*----------------------------- build_operator_trie ---------------------------*/
+/*
+    Description:
+      Rebuilds op_trie from the operator tables.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      Called at the end of make_closures(), so anything an inheritor
+      adds to the tables there is picked up.  Everything in the
+      tables then is a built-in, as far as register_ospec_operator()
+      is concerned.
+*/
+static void
+build_operator_trie()
+{
+  mapping tables;
+  string *kinds, *tokens;
+  int i, j, size, len;
+
+  op_trie = ([ ]);
+  builtin_ops = ([ ]);
+  tables = ([ "exact_matches" : exact_matches,
+              "number_prefix" : number_prefix,
+              "string_prefix" : string_prefix,
+              "normal_op"     : normal_op ]);
+  for( kinds = OP_KINDS, i=0, size=sizeof(kinds); i < size; i++ )
+  {
+    builtin_ops[kinds[i]] = ([ ]);
+    for( tokens = m_indices( tables[kinds[i]] ), j=0, len=sizeof(tokens);
+         j < len; j++ )
+      if( stringp( tokens[j] ) && strlen( tokens[j] ) )
+      {
+        trie_insert( kinds[i], tokens[j] );
+        builtin_ops[kinds[i]][tokens[j]] = 1;
+      }
+  }
+}
 
+/*----------------------------- match_operator ---------------------------*/
+/*
+    Description:
+      Finds the operator a term uses, in one pass over the term.
+    Parameters:
+      arg  - A term in the ospec
+      head - If the term has arguments (foo.bar), the length of the
+             part before the first delimiter, else -1
+    Returns:
+      ({ kind, length of token }), or 0 if no operator matches.
+    Notes:
+      With arguments, only normal_op is checked.  Without, the whole
+      term as an exact match wins, then a number prefix (the part
+      before the first digit), then the longest string prefix.
+*/
+static mixed *
+match_operator( string arg, int head )
+{
+  mapping node;
+  int i, len, num, str;
+  status digits;
+
+  node = op_trie;
+  len = strlen( arg );
+  num = str = -1;
+  for( i=0; ; i++ )
+  {
+    if( head == i )
+      return node["normal_op"] ? ({ "normal_op", i }) : 0;
 
-  /*******************
-  ** TRANSFORMATIONS
-  *******************/
+    if( head < 0 && i )
+    {
+      if( node["string_prefix"] )
+        str = i;
+      if( ( i < len ) && node["number_prefix"] && !digits
+          && ( arg[i] >= '0' ) && ( arg[i] <= '9' ) )
+        num = i;
+    }
 
-  exact_matches["u"] =
-    lambda( ({ 'prev, 'arg, 'first }),
+    if( i == len )
+    {
+      if( head < 0 && node["exact_matches"] )
+        return ({ "exact_matches", i });
+      break;
+    }
+    if( ( arg[i] >= '0' ) && ( arg[i] <= '9' ) )
+      digits = 1;
+    if( !mappingp( node = node[arg[i]] ) )
+      break;
+  }
+
+  if( num != -1 )
+    return ({ "number_prefix", num });
+  if( str != -1 )
+    return ({ "string_prefix", str });
+  return 0;
+}
+
+/*------------------------- register_ospec_operator ---------------------------*/
+/*
+    Description:
+      Adds an operator to the ospec syntax.
+    Parameters:
+      kind   - "exact_matches" (the whole term, like "me"),
+               "number_prefix" (followed by a number, like "#3"),
+               "string_prefix" (followed by anything, like "*zamboni"),
+               or "normal_op" (followed by arguments, like "id.sword")
+      token  - the operator, like "me", "#", "*", or "id"
+      func   - called as func(prev, arg, first, priorities), where arg
+               is what follows the token (a string, an int for number
+               prefixes, or the exploded term for normal ops), and
+               should return an object or array of objects
+      stream - optional.  If the operator works on each object in prev
+               on its own, a closure called as stream(ob, arg) that
+               returns what ob turns into.
+    Returns:
+      1 on success, 0 if kind or token is no good, or if token is one
+      of the built-in operators of that kind.
+    Notes:
+      A func of 0 removes the operator.  Compiled specs are thrown out,
+      so the change takes effect right away.  Operators added this way
+      last until the engine is reloaded.
+      Static, since every user's specs go through the engine: only the
+      engine inheriting this can change its syntax, and even it can't
+      change what "me" or "*foo" mean.  To change a built-in, override
+      make_closures().
+*/
+static varargs status
+register_ospec_operator( string kind, string token, closure func,
+                         closure stream )
+{
+  mapping table;
+
+  if( !stringp( token ) || !strlen( token )
+      || ( member( OP_KINDS, kind ) == -1 )
+      || builtin_ops[kind][token] )
+    return 0;
+
+  table = ([ "exact_matches" : exact_matches,
+             "number_prefix" : number_prefix,
+             "string_prefix" : string_prefix,
+             "normal_op"     : normal_op ])[kind];
+
+  if( !closurep( func ) )
+  {
+    m_delete( table, token );
+    m_delete( stream_ops[kind], token );
+    trie_remove( kind, token );
+  } else
+  {
+    table[token] = func;
+    if( closurep( stream ) )
+      stream_ops[kind][token] = stream;
+    else
+      m_delete( stream_ops[kind], token );
+    trie_insert( kind, token );
+  }
+
+  flush_ospec_plans();
+  return 1;
+}
+
+/*----------------------------- make_closures ---------------------------*/
+/*
+    Description:
+      Binds some closures for convenient use in ospec transforms.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      None.
+*/
+static void
+make_closures()
+{
+  cl = ([ ]);
+  exact_matches = ([ ]);
+  string_prefix = ([ ]);
+  number_prefix = ([ ]);
+  normal_op = ([ ]);
+  op_compilers = ([ ]);
+  stream_ops = ([ "exact_matches" : ([ ]),
+                  "number_prefix" : ([ ]),
+                  "string_prefix" : ([ ]),
+                  "normal_op"     : ([ ]) ]);
+
+  // Any plans we have were compiled against the old tables.
+  flush_ospec_plans();
+  flush_mapfile_cache();
+
+  cl["shad_1"] = lambda( ({ 'o, 'i }),
+                        ({ #'checked_item,
+			   ({ #'all_shadows, 'o }), 'i }));
+  cl["shad_1_rev"] = lambda( ({ 'o, 'i }),
+                        ({ #'checked_item_reverse,
+                           ({ #'all_shadows, 'o }), 'i }));
+  cl["invnum"] = lambda( ({ 'o, 'i }),
+                         ({ #'checked_item,
+		           ({ #'all_inventory, 'o }), 'i }));
+
+  cl["progname"] = lambda( ({ 'o, 'pn }),
+                           ({ #'== , ({ #'load_name, 'o }), 'pn }));
+
+  cl["present"] = lambda( ({ 'o, 'arg }),
+                          ({ #'present, 'arg, 'o }) );
+
+  exact_matches["me"] = lambda(0, ({ #'this_player }) );
+  exact_matches["here"] = lambda( 0, ({ #'environment, ({ #'this_player }) }));
+  exact_matches["it"] = exact_matches["him"] =
+    exact_matches["her"] = exact_matches["them"] =
+    lambda( ({ 'prev, 'arg, 'first }),
+            ({ #'query, 'arg, DATASPACE_CL }) );
+
+
+  /*******************
+  ** TRANSFORMATIONS
+  *******************/
+
+  exact_matches["u"] =
+    lambda( ({ 'prev, 'arg, 'first }),
             ({ #'?, 'first, ({ #'users }),
                             ({ #'filter_array, 'prev, #'interactive }) }) );
 
@@ -359,22 +1167,25 @@ make_closures()
     lambda( ({ 'prev, 'arg, 'first }),
             MAP_AND_FLATTEN( #'all_environment ) );
 
+  stream_ops["exact_matches"]["i"] =
+    lambda( ({ 'o, 'arg }), ({ #'all_inventory, 'o }) );
+  stream_ops["exact_matches"]["I"] = LAZY_DEEP;
+  stream_ops["exact_matches"]["s"] =
+    lambda( ({ 'o, 'arg }), ({ #'all_shadows, 'o }) );
+  stream_ops["exact_matches"]["e"] =
+    lambda( ({ 'o, 'arg }), ({ #'environment, 'o }) );
+  stream_ops["exact_matches"]["E"] =
+    lambda( ({ 'o, 'arg }), ({ #'all_environment, 'o }) );
+
   /************************
   **   REDUCTIONS
   ************************/
 
   exact_matches["!="] =
     lambda( ({ 'prev, 'arg, 'first }),
-            ({ #'unique_array, 'prev }) );
-
+            ({ #'unique_array_ordered, 'prev, 0 }) );
 
 
-  // I could make an add_string_prefix() that kept these numbers
-  // accurate, but that seems like more trouble and encapsulation than
-  // this is worth right now.  It will seem more valuable after I
-  // forget to change this once and spend an hour figuring out why my
-  // new prefix doesn't work right.  :-)
-  max_len_string_prefix = 2;
 
   // Players
   string_prefix["*"] =
@@ -411,6 +1222,11 @@ make_closures()
     lambda( ({ 'prev, 'arg, 'first }),
             MAP_AND_FLATTEN_cl("shad_1") );
 
+  stream_ops["number_prefix"]["#"] = stream_ops["number_prefix"]["i"] =
+    cl["invnum"];
+  stream_ops["number_prefix"]["s-"] = cl["shad_1_rev"];
+  stream_ops["number_prefix"]["s"] = cl["shad_1"];
+
   // Map Objects
   string_prefix["->"] =
     lambda( ({ 'prev, 'arg, 'first }),
@@ -424,7 +1240,7 @@ make_closures()
   // Remove objects
   string_prefix["!="] =
     lambda( ({ 'prev, 'arg, 'first, 'priorities }),
-            ({ #'exclude_array, 'prev,
+            ({ #'exclude_array_ordered, 'prev,
                    ({ #'parse_ospec, 'arg, 0, 'priorities }) }) );
 
   // Keep if equal to ..
@@ -433,6 +1249,10 @@ make_closures()
             ({ #'intersect_array, 'prev,
                    ({ #'parse_ospec, 'arg, 0, 'priorities }) }) );
 
+  set_op_names = ([ string_prefix["+"]  : "+",
+                    string_prefix["!="] : "!=",
+                    string_prefix["=="] : "==" ]);
+
 
   /***********************
   **     OrdLevel ranges
@@ -463,7 +1283,8 @@ make_closures()
   // mapfile - take each line, map it somehow into objects
   // usage: mapfile.filename.efunname
   // example: mapfile.~/etc/folks.find_player
-  normal_op["mapfile"] =
+  // mapfile! - same, but read and resolve the file again right now
+  normal_op["mapfile"] = normal_op["mapfile!"] =
     lambda( ({ 'prev, 'args, 'first }),
             ({ #'spec_mapfile, 'prev, 'args, 'first }) );
 
@@ -477,6 +1298,11 @@ make_closures()
     lambda( ({ 'prev, 'args, 'first }),
             ({ #'spec_revsort_closure, 'prev, 'args }) );
 
+  // Build the filter and sort closures when the spec is compiled.
+  op_compilers["f"]     = #'compile_filter;
+  op_compilers["sort"]  = #'compile_sort;
+  op_compilers["sort-"] = #'compile_sort;
+
   // Shortcut for f.==.->id."blah"
   normal_op["id"] =
     lambda( ({ 'prev, 'args, 'first }),
@@ -493,16 +1319,38 @@ make_closures()
             ({ #'filter_array, 'prev, C_IDX( ({ #'cl }) , "progname"),
                    C_IDX('args, 1) }) );
 
+  // Only used when f. was compiled and doesn't refer to LIST.
+  stream_ops["normal_op"]["f"] =
+    lambda( ({ 'o, 'fcl }),
+            ({ #'?, ({ #'funcall, 'fcl, 'o, 0 }), 'o, 0 }) );
+  stream_ops["normal_op"]["id"] =
+    lambda( ({ 'o, 'args }),
+            ({ #'?, ({ #'call_other, 'o, "id", C_IDX('args, 1) }), 'o, 0 }) );
+  stream_ops["normal_op"]["prop"] =
+    lambda( ({ 'o, 'args }),
+            ({ #'?, ({ #'call_other, 'o, "test_prop", C_IDX('args, 1) }),
+                    'o, 0 }) );
+  stream_ops["normal_op"]["prog"] =
+    lambda( ({ 'o, 'args }),
+            ({ #'?, ({ #'funcall, cl["progname"], 'o, C_IDX('args, 1) }),
+                    'o, 0 }) );
+
   // IP name matches regexp
   normal_op["ip"] =
     lambda( ({ 'prev, 'args, 'first }),
             ({ #'spec_ip, 'prev, 'args, 'first }) );
 
+  // Clones of a program, from the clone index
+  normal_op["clones"] =
+    lambda( ({ 'prev, 'args, 'first }),
+            ({ #'spec_clones, 'prev, 'args, 'first }) );
+
   // Users/Players, possibly restricted by level
   normal_op["u"] = normal_op["level"] =
     lambda( ({ 'prev, 'args, 'first }),
             ({ #'spec_level, 'prev, 'args, 'first }) );
 
+  build_operator_trie();
 }
 
 /*----------------------------- create ---------------------------*/
@@ -527,6 +1375,10 @@ create()
   internal_delimiter = ".";
   default_priorities = (FT_InvItem    FT_EnvItem FT_FindObject
                         FT_FindPlayer FT_File    FT_FindLiving);
+  async_jobs = ([ ]);
+  impure_functions = ([ ]);
+  map_array( IMPURE_FUNCTIONS, #'set_ospec_impure, 1 );
+  forget_history();
   make_closures();
 }
 
@@ -592,11 +1444,11 @@ value_closure( string arg )
                    ..searcha_str_unescaped( arg, '\)', strlen(arg)-1, -1) - 1];
       args = map_array( explode_argspec( argspec ), #'value_closure );
       return args
-        ? ({ #'funcall, #'call_other, 'thiso, tmp }) + args
+        ? memo_call( tmp, tmp, args )
         : 0; // there was some kind of error.
     } else
     {
-      return ({ #'call_other, 'thiso, tmp });
+      return memo_call( tmp, tmp, 0 );
     }
   }
 
@@ -604,7 +1456,7 @@ value_closure( string arg )
       || sscanf( arg, "#'%s", tmp ) )
   {
     tmpcl = SafeBindSym( tmp );
-    return closurep( tmpcl ) ? ({ #'funcall, tmpcl, 'thiso }) : 0;
+    return closurep( tmpcl ) ? memo_call( tmpcl, "#'" + tmp, 0 ) : 0;
   }
 
   max = strlen( arg ) - 1;
@@ -709,6 +1561,80 @@ make_filter_closure( string *args )
   return closurep( cl ) ? SafeBind( cl ) : 0;
 }
 
+/*----------------------------- volatile_value ---------------------------*/
+/*
+    Description:
+      Checks whether a value specifier contains a nested ospec.
+    Parameters:
+      arg - A value specifier
+    Returns:
+      True if arg, or any argument inside it, is an (ospec) or [ospec].
+    Notes:
+      value_closure() evaluates nested ospecs while it builds the
+      closure, so closures made from them can't be kept in a plan.
+*/
+static status
+volatile_value( string arg )
+{
+  int open, close;
+
+  if( !stringp( arg ) || !strlen( arg ) || ( arg[0] == '\"' ) )
+    return 0;
+
+  if( ( arg[0] == '\(' ) || ( arg[0] == '\[' ) )
+    return 1;
+
+  if( ( -1 == ( open = searcha_str_unescaped( arg, '\(' ) ) )
+      || ( -1 == ( close = searcha_str_unescaped( arg, '\)', strlen(arg)-1,
+                                                  -1 ) ) )
+      || ( close <= open + 1 ) )
+    return 0;
+
+  return sizeof( filter_array( explode_argspec( arg[open+1..close-1] ),
+                               #'volatile_value ) ) > 0;
+}
+
+/*----------------------------- compile_filter ---------------------------*/
+/*
+    Description:
+      Builds the filter closure for an f. term ahead of time.
+    Parameters:
+      args - The exploded term, starting with "f"
+    Returns:
+      ({ closure, filter closure }) for the step, or 0 if the filter
+      has to be built each time the term is evaluated.
+    Notes:
+      See op_compilers.
+*/
+static mixed *
+compile_filter( string *args )
+{
+  if( sizeof( filter_array( args[1..], #'volatile_value ) ) )
+    return 0;
+  return ({ #'spec_filter_compiled, make_filter_closure( args[1..] ) });
+}
+
+/*----------------------------- compile_sort ---------------------------*/
+/*
+    Description:
+      Builds the key closures for a sort. or sort-. term ahead of time.
+    Parameters:
+      args - The exploded term, starting with "sort" or "sort-"
+    Returns:
+      ({ closure, ({ keys, high_to_low }) }) for the step, or 0 if
+      the keys have to be built each time the term is evaluated.
+    Notes:
+      See op_compilers.
+*/
+static mixed *
+compile_sort( string *args )
+{
+  if( sizeof( filter_array( args[1..], #'volatile_value ) ) )
+    return 0;
+  return ({ #'spec_sort_compiled,
+            ({ make_sort_keys( args ), args[0] == "sort" }) });
+}
+
 /*----------------------------- unnest ---------------------------*/
 /*
     Description:
@@ -733,92 +1659,114 @@ unnest( string ospec )
 }
 
 
-/*----------------------------- parse_single ---------------------------*/
+/*----------------------------- make_step ---------------------------*/
+/*
+    Description:
+      Packages one compiled term of an ospec plan.
+    Parameters:
+      func - closure to evaluate, called as (prev, arg, first, priorities)
+      arg  - argument bound to the term at compile time
+      kind - name of the table or rule that matched the term
+      term - the source text of the term
+    Returns:
+      A step, suitable for run_subspec().
+    Notes:
+      See the STEP_* defines for the layout.
+*/
+static mixed *
+make_step( closure func, mixed arg, string kind, string term )
+{
+  mixed *step;
+  step = allocate( STEP_SIZE );
+  step[STEP_CL]   = func;
+  step[STEP_ARG]  = arg;
+  step[STEP_KIND] = kind;
+  step[STEP_TERM] = term;
+  return step;
+}
+
+/*----------------------------- compile_single ---------------------------*/
 /*
     Description:
-      Third level parsing routine.  Handles things like "m" and "*zamboni"
+      Third level compiling routine.  Handles things like "m" and "*zamboni"
     Parameters:
       arg   - A term in the ospec
-      prev  - An array of objects to use as context
-      first - True if this is the first term
     Returns:
-      An array of objects referred to by arg in the context of prev
-      and first.
+      A step which, when run, yields the objects referred to by arg.
     Notes:
-      Can have side effects by calling parse_ospec() recursively, and
-      through efun and lfun calls specified in arg.
-      This is usually called from parse_subspec().
+      Everything that only depends on the text of the term is done
+      here, once.  Anything that depends on THISP, the context list, or
+      whether this is the first term is left to the step's closure.
+      This is usually called from compile_subspec().
 */
-static object *
-parse_single(string arg, object *prev, status first, string priorities)
+static mixed *
+compile_single( string arg )
 {
   string *args;
   string tmp;
   int numargs, itmp, itmp2;
-  mixed mtmp;
-
-  if(!stringp(arg) || arg == "")
-    return prev;
+  mixed mtmp, *step;
 
   // I split it up like this so I can do faster checks on the parameters.
   args = explode_nested(arg, internal_delimiter);
   numargs = sizeof(args);
 
-  if(!prev)
-    prev = ({ });
-
-
-  if(numargs == 1)
+  if(numargs <= 1)
   {
     if( (tmp = unnest( arg )) != arg )
-      return parse_ospec( tmp, 0, priorities );
-
-    if( member( exact_matches, arg ) )
-    {
-      mtmp = funcall( exact_matches[arg], prev, arg, first );
-      return pointerp(mtmp) ? mtmp : ({ mtmp });
-    }
+      return make_step( #'spec_nested, compile_ospec( tmp ), "nested", arg );
 
-    if( -1 != ( itmp = searcha_any_str( arg, "0123465789" ) ) )
-      if( member( number_prefix, tmp=arg[0..itmp-1] ) )
-      {
-        itmp = to_int( arg[itmp..] );
-        mtmp = funcall( number_prefix[tmp], prev, itmp, first, priorities );
-        return pointerp(mtmp) ? mtmp : ({ mtmp });
-      }
-
-    // for arg=="blah", and max.. == 2, check for prefixes "bl", then "b".
-    itmp = strlen( arg );
-    for( itmp = MIN(itmp, max_len_string_prefix) - 1; itmp >= 0; itmp-- )
+    if( mtmp = match_operator( arg, -1 ) )
     {
-      if( member( string_prefix, arg[0..itmp] ) )
+      tmp = arg[0..mtmp[1]-1];
+      switch( mtmp[0] )
       {
-        mtmp = funcall( string_prefix[arg[0..itmp]], prev, arg[itmp+1..],
-                        first, priorities );
-        return pointerp(mtmp) ? mtmp : ({ mtmp });
+        case "exact_matches":
+          step = make_step( exact_matches[arg], arg, "exact_matches", arg );
+          break;
+        case "number_prefix":
+          step = make_step( number_prefix[tmp], to_int( arg[mtmp[1]..] ),
+                            "number_prefix", arg );
+          break;
+        default:
+          step = make_step( string_prefix[tmp], arg[mtmp[1]..],
+                            "string_prefix", arg );
       }
+      step[STEP_STREAM] = stream_ops[mtmp[0]][tmp];
+      return step;
     }
 
     if (sscanf(arg, "[%d]", itmp))
-      return ({ checked_item(prev, itmp) });
+      return make_step( #'spec_item, itmp, "index", arg );
   } else
   {
 
-    // If there's a match for the operation named, evaluate it.
-    if( member( normal_op, args[0] ) )
+    // If there's a match for the operation named, compile it.
+    if( match_operator( arg, strlen( args[0] ) ) )
     {
-      mtmp = funcall( normal_op[args[0]], prev, args, first, priorities );
-      return pointerp(mtmp) ? mtmp : ({ mtmp });
+      // Some operations can do most of their work up front.
+      if( member( op_compilers, args[0] ) )
+      {
+        if( !pointerp( mtmp = funcall( op_compilers[args[0]], args ) ) )
+          return make_step( normal_op[args[0]], args, "normal_op", arg );
+        step = make_step( mtmp[0], mtmp[1], "normal_op", arg );
+      } else
+        step = make_step( normal_op[args[0]], args, "normal_op", arg );
+
+      // A filter that looks at LIST needs the whole list at once.
+      if( strstr( arg, "LIST" ) == -1 )
+        step[STEP_STREAM] = stream_ops["normal_op"][args[0]];
+      return step;
     }
 
     if (arg[0] == '\[')
     {
       if (sscanf(arg, "[%d..<%d]", itmp, itmp2) == 2)
-        return prev[itmp..<itmp2];
+        return make_step( #'spec_range, ({ itmp, itmp2, 1 }), "index", arg );
       if (sscanf(arg, "[%d..%d]", itmp, itmp2) == 2)
-        return prev[itmp..itmp2];
+        return make_step( #'spec_range, ({ itmp, itmp2, 0 }), "index", arg );
       if (sscanf(arg, "[%d..]", itmp))
-        return prev[itmp..<1];
+        return make_step( #'spec_range, ({ itmp, 1, 1 }), "index", arg );
     }
   }
 
@@ -826,151 +1774,1314 @@ parse_single(string arg, object *prev, status first, string priorities)
   // Do we have strong reason to believe it's a file?
   if( ( member( arg, '/' ) != -1 )
       || ( arg[<2..] == ".c" ) )
-    return resolve_filespec( arg, 1 );
-
-  if( !first )
-    return map_array(prev, cl["present"], arg);
+    return make_step( #'spec_file, arg, "file", arg );
 
   /* The DWIM last resort */
-  return find_targets( arg, priorities, 1, prev );
+  return make_step( #'spec_dwim, arg, "find_targets", arg );
+}
+
+/*----------------------------- group_set_ops ---------------------------*/
+/*
+    Description:
+      Combines each run of +, != and == terms into one step.
+    Parameters:
+      steps - The compiled terms of a subspec
+    Returns:
+      steps, with each run replaced by a spec_set_ops() step.
+    Notes:
+      spec_set_ops() does the whole run with mappings, so something
+      like "I:!=i:+e" takes time proportional to the objects involved,
+      and comes out without duplicates, in the order they joined the
+      set.
+*/
+static mixed *
+group_set_ops( mixed *steps )
+{
+  mixed *out, *ops;
+  string *terms, op;
+  int i, j, size;
+
+  out = ({ });
+  for( i=0, size=sizeof(steps); i < size; i = j )
+  {
+    ops = ({ });
+    terms = ({ });
+    for( j=i; j < size
+           && ( steps[j][STEP_KIND] == "string_prefix" )
+           && ( op = set_op_names[steps[j][STEP_CL]] ); j++ )
+    {
+      ops += ({ ({ op, steps[j][STEP_ARG] }) });
+      terms += ({ steps[j][STEP_TERM] });
+    }
+    if( j == i )
+      out += ({ steps[j++] });
+    else
+      out += ({ make_step( #'spec_set_ops, ops, "set_ops",
+                           implode( terms, subspec_delimiter ) ) });
+  }
+  return out;
 }
 
-/*----------------------------- parse_subspec ---------------------------*/
+/*----------------------------- compile_subspec ---------------------------*/
 /*
     Description:
-      Second level parsing routine.
+      Second level compiling routine.
     Parameters:
       ospec - A subspec string.
-      prev  - An array of objects to use as context, or 0.
     Returns:
-      An array of objects referred to by ospec in the context of prev.
+      An array of steps, one for each non-empty term in ospec.
     Notes:
-      prev should normally be 0.
-      This is usually called from parse_ospec().
-      Can have side effects by calling parse_ospec() recursively.
+      This is usually called from compile_ospec().
 */
-static object *
-parse_subspec(string ospec, object *prev, string priorities)
+static mixed *
+compile_subspec( string ospec )
 {
   string *args;
   string tmp;
-  int i, size, first;
-  object *list;
+  mixed *steps;
+  int i, j, size;
 
   args = stringp(ospec)
     ? explode_nested( ospec, subspec_delimiter, 0, C_OPEN, C_CLOSE )
-    : args = ({ });
+    : ({ });
 
-  size=sizeof(args);
+  size = sizeof(args);
 
   if( ( size == 1 ) && ( (tmp = unnest( ospec )) != ospec ) )
-    return parse_ospec( tmp, 0, priorities );
-
-  if(!prev)
-  {
-    first = 1;
-    prev = ({ THISP });
-  }
-
-  for(i=0; i < size; i++)
-  {
-    if(args[i] == "")
-      continue;
-
-    prev = filter_array(prev, #'objectp);
-    prev = parse_single(args[i], prev, first, priorities);
-    first = 0;
-  }
-  return prev;
+    return ({ make_step( #'spec_nested, compile_ospec( tmp ), "nested",
+                         ospec ) });
+
+  steps = allocate( size );
+  for( i=0; i < size; i++ )
+    if( args[i] != "" )
+      steps[j++] = compile_single( args[i] );
+  return group_set_ops( steps[0..j-1] );
 }
 
-/*----------------------------- parse_ospec ---------------------------*/
+/*----------------------------- compile_ospec ---------------------------*/
 /*
     Description:
-      Top level parsing routine.
+      Top level compiling routine.
     Parameters:
       ospec - An object specification string.
-      prev  - An array of objects to use as context, or 0.
     Returns:
-      An array of objects referred to by ospec in the context of prev.
+      A plan: an array with one array of steps for each subspec.
     Notes:
-      prev should normally be 0.
-      Will set one of the variables "him", "her", "it", or "them".
-      Will set the variable "$".
+      Plans hold no references to THISP or to any objects found, so
+      they can be shared between users.  Use query_ospec_plan() rather
+      than calling this directly so the result gets cached.
 */
-object *
-parse_ospec(string ospec, object *prev, string priorities)
+static mixed *
+compile_ospec( string ospec )
 {
-  object *list;
-  object *subval;
-  int size, i;
   string *sublists;
-  string dataspace;
-
-  if(!stringp(ospec) || !strlen(ospec))
-    return 0;
-
-  if( !stringp( priorities ) )
-    priorities = default_priorities;
 
   ospec = unnest( ospec );
-
   sublists = explode_nested( ospec, spec_delimiter, 0, C_OPEN, C_CLOSE );
-  size = sizeof(sublists);
+  return map_array( sublists || ({ }), #'compile_subspec );
+}
 
-  list = ({ });
+/*----------------------------- query_ospec_plan ---------------------------*/
+/*
+    Description:
+      Finds the compiled plan for an ospec, compiling it if necessary.
+    Parameters:
+      ospec      - An object specification string.
+      priorities - The priority string it will be evaluated with.
+    Returns:
+      The plan.
+    Notes:
+      Plans are kept in a cache of at most PLAN_CACHE_SIZE entries.
+      When it is full, the least recently used plan is thrown out.
+*/
+static mixed *
+query_ospec_plan( string ospec, string priorities )
+{
+  string key, oldest;
+  mixed *entry, *keys;
+  int i, size, stamp;
 
-  for(i=0; i < size; i++)
+  // Plans made while memoizing have memo_call()s compiled in.
+  key = ( memo ? "memo\n" : "" ) + priorities + "\n" + ospec;
+  if( entry = plan_cache[key] )
   {
-    subval = parse_subspec(sublists[i], prev, priorities);
-    if(pointerp(subval))
-      list += subval;
+    entry[1] = ++plan_clock;
+    return entry[0];
   }
 
-  list = filter_array(list, #'objectp);
-  dataspace = DATASPACE;
-  set("$", list, dataspace);
-  if( sizeof( list ) > 0)
+  if( sizeof( plan_cache ) >= PLAN_CACHE_SIZE )
   {
-    if( sizeof( list ) > 1)
-      set( "them", list, dataspace );
-    else
-    {
-      if( living( list[0] ) )
-        switch( list[0]->query_gender() )
-        {
-          case "male":
-            set( "him", list, dataspace ); break;
-          case "female":
-            set( "her", list, dataspace ); break;
-          default:
-            set( "it", list, dataspace );
-        }
-      else
-        set( "it", list, dataspace );
-    }
+    keys = m_indices( plan_cache );
+    stamp = plan_clock + 1;
+    for( i=0, size=sizeof(keys); i < size; i++ )
+      if( plan_cache[keys[i]][1] < stamp )
+      {
+        stamp = plan_cache[keys[i]][1];
+        oldest = keys[i];
+      }
+    m_delete( plan_cache, oldest );
   }
 
-  return list;
+  entry = ({ compile_ospec( ospec ), ++plan_clock });
+  plan_cache[key] = entry;
+  return entry[0];
+}
+
+/*----------------------------- flush_ospec_plans ---------------------------*/
+/*
+    Description:
+      Throws out all the cached plans.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      This is done automatically whenever the operator tables are
+      rebuilt.
+*/
+void
+flush_ospec_plans()
+{
+  plan_cache = ([ ]);
 }
 
+/*----------------------------- pull_object ---------------------------*/
+/*
+    Description:
+      Pushes one object through the rest of a chain of streamable steps.
+    Parameters:
+      ob    - An object from the list before step k
+      chain - Steps which all have a STEP_STREAM
+      k     - Index of the next step in chain to apply to ob
+      out   - Preallocated result array
+      count - Number of slots of out filled so far (pass by reference)
+    Returns:
+      True once out is full, at which point everyone stops.
+    Notes:
+      Objects come out in the same order as if each step had been
+      applied to the whole list in turn.
+*/
+static status
+pull_object( mixed ob, mixed *chain, int k, object *out, int count )
+{
+  mixed items;
+  int i, size;
+
+  if( !objectp( ob ) )
+    return 0;
 
-/*------------------------- evaluate_object_spec ---------------------------*/
+  if( k == sizeof( chain ) )
+  {
+    out[count++] = ob;
+    return count >= sizeof( out );
+  }
+
+  if( chain[k][STEP_STREAM] == LAZY_DEEP )
+    return pull_deep( ob, chain, k, out, &count );
+
+  items = funcall( chain[k][STEP_STREAM], ob, chain[k][STEP_ARG] );
+  if( !pointerp( items ) )
+    return pull_object( items, chain, k+1, out, &count );
+
+  for( i=0, size=sizeof(items); i < size; i++ )
+    if( pull_object( items[i], chain, k+1, out, &count ) )
+      return 1;
+  return 0;
+}
+
+/*----------------------------- pull_deep ---------------------------*/
 /*
     Description:
-      Opie conformant access point.
+      Streaming version of deep_inventory().
     Parameters:
-      ospec  - An object specification string.
-      tool   - The tool that is passing us this spec.
+      ob    - The object whose deep inventory is wanted
+      (the rest are as for pull_object())
     Returns:
-      An array of objects referred to by ospec.
+      True once out is full.
     Notes:
-      None.
+      Same order as deep_inventory(): an object's whole inventory, then
+      the deep inventory of each of those objects in turn.  Only as
+      much of the tree as is needed gets looked at.
 */
-object *
-evaluate_object_spec(string ospec, object tool, string priorities)
+static status
+pull_deep( object ob, mixed *chain, int k, object *out, int count )
+{
+  object *inv;
+  int i, size;
+
+  inv = all_inventory( ob );
+  size = sizeof( inv );
+  for( i=0; i < size; i++ )
+    if( pull_object( inv[i], chain, k+1, out, &count ) )
+      return 1;
+  for( i=0; i < size; i++ )
+    if( first_inventory( inv[i] )
+        && pull_deep( inv[i], chain, k, out, &count ) )
+      return 1;
+  return 0;
+}
+
+/*----------------------------- stream_steps ---------------------------*/
+/*
+    Description:
+      Evaluates a chain of streamable steps, stopping early.
+    Parameters:
+      prev  - An array of objects to use as context
+      chain - Steps which all have a STEP_STREAM
+      need  - How many objects are wanted out of the end of the chain
+    Returns:
+      The first <need> objects that the chain would have produced.
+    Notes:
+      None.
+*/
+static object *
+stream_steps( object *prev, mixed *chain, int need )
+{
+  object *out;
+  int i, size, count;
+
+  out = allocate( need );
+  for( i=0, size=sizeof(prev); i < size; i++ )
+    if( pull_object( prev[i], chain, 0, out, &count ) )
+      break;
+  return out[0..count-1];
+}
+
+/*----------------------------- step_demand ---------------------------*/
+/*
+    Description:
+      Works out how many objects a step looks at.
+    Parameters:
+      step - A compiled step
+    Returns:
+      The number of objects from the front of the list that step
+      depends on, or 0 if it might need all of them.
+    Notes:
+      Only [n] and [a..b] have a bound.
+*/
+static int
+step_demand( mixed *step )
+{
+  if( step[STEP_KIND] != "index" )
+    return 0;
+  if( intp( step[STEP_ARG] ) )
+    return ( step[STEP_ARG] >= 0 ) ? step[STEP_ARG] + 1 : 0;
+  if( !step[STEP_ARG][2]
+      && ( step[STEP_ARG][0] >= 0 )
+      && ( step[STEP_ARG][1] >= step[STEP_ARG][0] ) )
+    return step[STEP_ARG][1] + 1;
+  return 0;
+}
+
+/*----------------------------- wall_clock ---------------------------*/
+/*
+    Description:
+      Reads the clock as precisely as the driver lets us.
+    Parameters:
+      None.
+    Returns:
+      ({ seconds, microseconds })
+    Notes:
+      Without utime() this is only good to the second.
+*/
+static int *
+wall_clock()
+{
+#if __EFUN_DEFINED__(utime)
+  return utime();
+#else
+  return ({ time(), 0 });
+#endif
+}
+
+/*----------------------------- profile_mark ---------------------------*/
+/*
+    Description:
+      Notes where things stand before a step is run, for profile_step().
+    Parameters:
+      prev - The list the step is about to be given.
+    Returns:
+      ({ input size, eval cost left, wall_clock() })
+    Notes:
+      Only used while profiling.
+*/
+static mixed *
+profile_mark( object *prev )
+{
+  return ({ sizeof(prev), get_eval_cost(), wall_clock() });
+}
+
+/*----------------------------- profile_step ---------------------------*/
+/*
+    Description:
+      Adds a row to the profile for a step that just ran.
+    Parameters:
+      mark  - from profile_mark(), taken just before the step
+      steps - the step, or the run of steps that were streamed together
+      out   - what the step(s) returned
+      streamed - true if stream_steps() ran them
+    Returns:
+      Nothing.
+    Notes:
+      Streamed steps are evaluated together, object by object, so they
+      get a single row with their terms and kinds joined by the
+      subspec delimiter.
+*/
+static varargs void
+profile_step( mixed *mark, mixed *steps, object *out, status streamed )
+{
+  int cost, *now;
+  string *terms, *kinds;
+  int i, size;
+
+  cost = get_eval_cost();
+  now = wall_clock();
+
+  size = sizeof(steps);
+  terms = allocate(size);
+  kinds = allocate(size);
+  for( i=0; i < size; i++ )
+  {
+    terms[i] = steps[i][STEP_TERM];
+    kinds[i] = steps[i][STEP_KIND];
+  }
+
+  profile_rows += ({ ([ "depth"   : profile_depth,
+                        "subspec" : profile_subspec,
+                        "term"    : implode(terms, subspec_delimiter),
+                        "kind"    : implode(kinds, subspec_delimiter),
+                        "streamed": streamed,
+                        "in"      : mark[0],
+                        "out"     : sizeof(out),
+                        "eval"    : mark[1] - cost,
+                        "usecs"   : ( now[0] - mark[2][0] ) * 1000000
+                                    + now[1] - mark[2][1] ]) });
+}
+
+/*----------------------------- run_subspec ---------------------------*/
+/*
+    Description:
+      Evaluates the steps of one compiled subspec.
+    Parameters:
+      steps      - A compiled subspec, from compile_subspec().
+      prev       - An array of objects to use as context, or 0.
+      priorities - The priority string to pass to each step.
+      limit      - If nonzero, only this many objects are wanted.
+    Returns:
+      An array of objects referred to by the subspec in the context
+      of prev.
+    Notes:
+      prev should normally be 0.
+      This is usually called from run_plan().
+      Can have side effects by calling parse_ospec() recursively.
+
+      When a run of streamable steps is followed by an index or
+      range, or ends the subspec and there is a limit, the run is
+      evaluated one object at a time and stops as soon as enough
+      objects have come out the other end.  So "I:[0]" only looks at
+      the first thing in your inventory.
+*/
+static object *
+run_subspec( mixed *steps, object *prev, string priorities, int limit )
+{
+  int i, j, size, need;
+  status first;
+  mixed mtmp, *mark;
+
+  if(!prev)
+  {
+    first = 1;
+    prev = ({ THISP });
+  } else
+    prev = filter_array(prev, #'objectp);
+
+  // Streamed steps only ever produce objects, so the list only needs
+  // cleaning up after ordinary steps.
+  for( i=0, size=sizeof(steps); i < size; i++ )
+  {
+    for( j=i; ( j < size ) && steps[j][STEP_STREAM]; j++ )
+      ;
+    if( j > i )
+    {
+      need = ( j < size ) ? step_demand( steps[j] ) : limit;
+      if( need > 0 )
+      {
+        if( profile_rows )
+          mark = profile_mark( prev );
+        prev = stream_steps( prev, steps[i..j-1], need );
+        if( profile_rows )
+          profile_step( mark, steps[i..j-1], prev, 1 );
+        first = 0;
+        i = j - 1;
+        continue;
+      }
+    }
+
+    if( profile_rows )
+      mark = profile_mark( prev );
+    mtmp = funcall( steps[i][STEP_CL], prev, steps[i][STEP_ARG], first,
+                    priorities );
+    prev = filter_array( pointerp(mtmp) ? mtmp : ({ mtmp }), #'objectp );
+    if( profile_rows )
+      profile_step( mark, steps[i..i], prev );
+    first = 0;
+  }
+  return prev;
+}
+
+/*----------------------------- set_union ---------------------------*/
+/*
+    Description:
+      Joins some lists of objects into one, without duplicates.
+    Parameters:
+      lists - An array of arrays of objects
+    Returns:
+      All the objects in lists, each once, in the order they first
+      appear.
+    Notes:
+      Anything that isn't an object is dropped.
+*/
+static object *
+set_union( mixed *lists )
+{
+  mapping seen;
+  object *out, *list;
+  int i, j, k, size, len;
+
+  seen = ([ ]);
+  for( i=0, size=sizeof(lists); i < size; i++ )
+    if( pointerp( lists[i] ) )
+      k += sizeof( lists[i] );
+  out = allocate( k );
+  k = 0;
+
+  for( i=0; i < size; i++ )
+    if( pointerp( list = lists[i] ) )
+      for( j=0, len=sizeof(list); j < len; j++ )
+        if( objectp( list[j] ) && !member( seen, list[j] ) )
+        {
+          seen[list[j]] = 1;
+          out[k++] = list[j];
+        }
+  return out[0..k-1];
+}
+
+/*----------------------------- run_plan ---------------------------*/
+/*
+    Description:
+      Evaluates a compiled ospec.
+    Parameters:
+      plan       - A plan, from query_ospec_plan().
+      prev       - An array of objects to use as context, or 0.
+      priorities - The priority string to use.
+      limit      - If nonzero, only this many objects are wanted.
+    Returns:
+      An array of objects referred to by the plan in the context of prev.
+    Notes:
+      Does not touch any variables.  See parse_ospec() for that.
+      Once <limit> objects have been found, the remaining subspecs
+      are not evaluated.  The subspecs' results are joined without
+      duplicates, in the order the objects first appear.
+      Each subspec is asked for <limit> objects, not just the ones
+      still missing, since some of them may have been found already.
+      If it still doesn't make up the difference, and may have been
+      cut short, it's evaluated again without a limit.
+*/
+static object *
+run_plan( mixed *plan, object *prev, string priorities, int limit )
+{
+  mixed *results;
+  object *subval, *all;
+  mapping seen;
+  int size, i, j, len;
+
+  results = allocate( size = sizeof(plan) );
+  seen = ([ ]);
+
+  for(i=0; i < size; i++)
+  {
+    profile_subspec = i;
+    subval = run_subspec(plan[i], prev, priorities, limit);
+    if(!pointerp(subval))
+      continue;
+
+    if( limit )
+    {
+      for( j=0, len=sizeof(subval); j < len; j++ )
+        if( objectp( subval[j] ) )
+          seen[subval[j]] = 1;
+      // It found all we asked for, but too many were ones we had
+      // already: there may be more where they came from.
+      if( ( sizeof(seen) < limit ) && ( len >= limit )
+          && pointerp( all = run_subspec(plan[i], prev, priorities, 0) ) )
+        for( j=0, len=sizeof(subval = all); j < len; j++ )
+          if( objectp( subval[j] ) )
+            seen[subval[j]] = 1;
+      results[i] = subval;
+      if( sizeof(seen) >= limit )
+        return set_union( results )[0..limit-1];
+    } else
+      results[i] = subval;
+  }
+
+  return set_union( results );
+}
+
+/*----------------------------- pronoun_of ---------------------------*/
+/*
+    Description:
+      Works out which pronoun refers to a result.
+    Parameters:
+      list - The objects an ospec evaluated to.
+    Returns:
+      "him", "her", "it", "them", or 0 if list is empty.
+    Notes:
+      Calls query_gender() in living things.
+*/
+static string
+pronoun_of( object *list )
+{
+  if( !sizeof( list ) )
+    return 0;
+  if( sizeof( list ) > 1 )
+    return "them";
+  if( objectp( list[0] ) && living( list[0] ) )
+    switch( list[0]->query_gender() )
+    {
+      case "male":
+        return "him";
+      case "female":
+        return "her";
+    }
+  return "it";
+}
+
+/*----------------------------- history_slot ---------------------------*/
+/*
+    Description:
+      Finds a result in a dataspace's history.
+    Parameters:
+      h - An entry of history
+      n - 1 for the latest result, 2 for the one before...
+    Returns:
+      The index of that result in h's arrays, or -1 if there isn't one.
+    Notes:
+      None.
+*/
+static int
+history_slot( mixed *h, int n )
+{
+  if( ( n < 1 ) || ( n > h[H_COUNT] ) )
+    return -1;
+  return ( h[H_NEXT] - n + HISTORY_SIZE ) % HISTORY_SIZE;
+}
+
+/*----------------------------- stamp_variable ---------------------------*/
+/*
+    Description:
+      Writes a variable that the history would otherwise answer for.
+    Parameters:
+      key, value, dataspace - as for set()
+      stamp                 - when the value is from
+    Returns:
+      Nothing.
+    Notes:
+      query() compares stamps to decide whether the history or the
+      variable is newer.
+*/
+static void
+stamp_variable( string key, mixed value, string dataspace, int stamp )
+{
+  if( !mappingp( var_stamps[dataspace] ) )
+    var_stamps[dataspace] = ([ ]);
+  var_stamps[dataspace][key] = stamp;
+  ::set( key, value, dataspace );
+}
+
+/*----------------------------- record_result ---------------------------*/
+/*
+    Description:
+      Remembers the result of an ospec in the user's history.
+    Parameters:
+      list - The objects an ospec evaluated to.
+    Returns:
+      list
+    Notes:
+      The result becomes "$" (and "$$" and "$1"), and may become "him",
+      "her", "it", or "them", but nothing is written to the variables
+      until it falls out of the history.  Then, if it's still the
+      latest for its pronoun, it's saved in that variable.
+*/
+static object *
+record_result( object *list )
+{
+  string dataspace, kind;
+  mixed *h;
+  int slot;
+
+  dataspace = DATASPACE;
+  if( !pointerp( h = history[dataspace] ) )
+  {
+    h = allocate( H_SIZE );
+    h[H_LISTS]  = allocate( HISTORY_SIZE );
+    h[H_STAMPS] = allocate( HISTORY_SIZE );
+    h[H_KINDS]  = allocate( HISTORY_SIZE );
+    history[dataspace] = h;
+  }
+
+  slot = h[H_NEXT];
+  if( h[H_COUNT] == HISTORY_SIZE )
+  {
+    // The oldest one is about to go.  Keep it if it's still the
+    // latest one its pronoun refers to.
+    kind = h[H_KINDS][slot]
+           || pronoun_of( filter_array( h[H_LISTS][slot], #'objectp ) );
+    if( kind
+        && ( h[H_STAMPS][slot] > ( var_stamps[dataspace] || ([]) )[kind] ) )
+      stamp_variable( kind, filter_array( h[H_LISTS][slot], #'objectp ),
+                      dataspace, h[H_STAMPS][slot] );
+  } else
+    h[H_COUNT]++;
+
+  h[H_LISTS][slot]  = list;
+  h[H_STAMPS][slot] = ++history_clock;
+  h[H_KINDS][slot]  = 0;
+  h[H_NEXT] = ( slot + 1 ) % HISTORY_SIZE;
+
+  return list;
+}
+
+/*----------------------------- set ---------------------------*/
+/*
+    Description:
+      VarSpace's set(), keeping track of when "$", the pronouns and the
+      history numbers were set by hand.
+    Parameters:
+      key, value, space_key - as for VarSpace's set()
+    Returns:
+      Nothing.
+    Notes:
+      A variable set by hand hides older results in the history.
+*/
+varargs void
+set( mixed key, mixed value, mixed space_key )
+{
+  if( stringp( key )
+      && ( ( key == "$" ) || to_int( key )
+           || ( member( PRONOUNS, key ) != -1 ) ) )
+    stamp_variable( key, value, space_key, ++history_clock );
+  else
+    ::set( key, value, space_key );
+}
+
+/*----------------------------- query ---------------------------*/
+/*
+    Description:
+      VarSpace's query(), answering from the result history.
+    Parameters:
+      key       - a variable name.  "$" is the latest result, "1".."16"
+                  are the latest results, and "him", "her", "it", and
+                  "them" are the latest results they refer to.
+      space_key - the dataspace
+    Returns:
+      The value, with destructed objects removed from results.
+    Notes:
+      Anything else, or anything that was set more recently than the
+      history has an answer for, comes from VarSpace.  Working out a
+      pronoun may call query_gender() in the results.
+*/
+varargs mixed
+query( mixed key, mixed space_key )
+{
+  mixed *h;
+  mapping stamps;
+  int n, slot;
+
+  if( !stringp( key ) || !mappingp( history )
+      || !pointerp( h = history[space_key] ) )
+    return ::query( key, space_key );
+
+  stamps = var_stamps[space_key] || ([ ]);
+
+  if( ( key == "$" ) || ( ( n = to_int( key ) ) && ( key == n + "" ) ) )
+  {
+    slot = history_slot( h, ( key == "$" ) ? 1 : n );
+    if( ( slot != -1 ) && ( h[H_STAMPS][slot] > stamps[key] ) )
+      return filter_array( h[H_LISTS][slot], #'objectp );
+    return ::query( key, space_key );
+  }
+
+  if( member( PRONOUNS, key ) == -1 )
+    return ::query( key, space_key );
+
+  for( n = 1; ( slot = history_slot( h, n ) ) != -1; n++ )
+  {
+    if( h[H_STAMPS][slot] <= stamps[key] )
+      break;
+    if( !h[H_KINDS][slot] )
+      h[H_KINDS][slot] = pronoun_of( h[H_LISTS][slot] ) || "";
+    if( h[H_KINDS][slot] == key )
+      return filter_array( h[H_LISTS][slot], #'objectp );
+  }
+  return ::query( key, space_key );
+}
+
+/*----------------------------- forget_history ---------------------------*/
+/*
+    Description:
+      Throws away a dataspace's result history.
+    Parameters:
+      dataspace - whose, or 0 for everyone's
+    Returns:
+      Nothing.
+    Notes:
+      Variables that were saved from it are left alone.
+*/
+varargs void
+forget_history( string dataspace )
+{
+  if( !dataspace )
+  {
+    history = ([ ]);
+    var_stamps = ([ ]);
+    return;
+  }
+  m_delete( history, dataspace );
+  m_delete( var_stamps, dataspace );
+}
+
+/*----------------------------- parse_plan ---------------------------*/
+/*
+    Description:
+      The part of parse_ospec() that isn't about profiling.
+    Parameters:
+      Same as parse_ospec(), with priorities filled in.
+    Returns:
+      Same as parse_ospec().
+    Notes:
+      None.
+*/
+private object *
+parse_plan( string ospec, object *prev, string priorities, int limit )
+{
+  object *list;
+  string err;
+
+  if( !memo_depth && !query( "memo", DATASPACE ) )
+    return record_result( run_plan( query_ospec_plan( ospec, priorities ),
+                                    prev, priorities, limit ) );
+
+  // Memoized calls are only good until the top-level spec is done.
+  if( !memo_depth++ )
+    memo = ([ ]);
+  err = catch( list = record_result(
+                 run_plan( query_ospec_plan( ospec, priorities ),
+                           prev, priorities, limit ) ) );
+  if( !--memo_depth )
+    memo = 0;
+  if( err )
+    raise_error( err );
+  return list;
+}
+
+/*----------------------------- parse_ospec ---------------------------*/
+/*
+    Description:
+      Top level parsing routine.
+    Parameters:
+      ospec - An object specification string.
+      prev  - An array of objects to use as context, or 0.
+      priorities - The priority string for DWIM terms, or 0.
+      limit - If nonzero, at most this many objects are wanted.
+    Returns:
+      An array of objects referred to by ospec in the context of prev,
+      or the first <limit> of them.
+    Notes:
+      prev should normally be 0.
+      The result becomes "$", and may become "him", "her", "it", or
+      "them".  See record_result().  With a limit, that's only the
+      first <limit> objects, not everything ospec could match.
+      If the variable "memo" is set, function calls in filters and
+      sorts are memoized until the top-level call returns.  See
+      memo_call().
+*/
+varargs object *
+parse_ospec(string ospec, object *prev, string priorities, int limit)
+{
+  object *list;
+  string err;
+  int subspec;
+
+  if(!stringp(ospec) || !strlen(ospec))
+    return 0;
+
+  if( !stringp( priorities ) )
+    priorities = default_priorities;
+
+  if( !profile_rows )
+    return parse_plan( ospec, prev, priorities, limit );
+
+  // A spec nested in one being profiled, from a set op, a (spec) or
+  // [spec] value, or a mapfile.  Its rows go one level deeper, and
+  // the outer spec's subspec number is put back afterwards.
+  subspec = profile_subspec;
+  profile_depth++;
+  err = catch( list = parse_plan( ospec, prev, priorities, limit ) );
+  profile_depth--;
+  profile_subspec = subspec;
+  if( err )
+    raise_error( err );
+  return list;
+}
+
+/*----------------------------- parse_ospecs ---------------------------*/
+/*
+    Description:
+      Parses a batch of specs.
+    Parameters:
+      specs      - An array of object specification strings.
+      priorities - The priority string for DWIM terms, or 0.
+      limits     - An array with parse_ospec()'s limit for each spec,
+                   or 0 for no limits.
+    Returns:
+      An array with what parse_ospec() returns for each spec, in the
+      same order, or 0 if specs isn't an array.
+    Notes:
+      The specs share one memo (see memo_call()), so a function that
+      several of them filter on is only called once per object.  Each
+      result is recorded in turn, so "$" is the last one afterwards.
+*/
+private void
+parse_each( string *specs, string priorities, mixed *lists, int *limits )
+{
+  int i, size;
+  for( i = 0, size = sizeof( specs ); i < size; i++ )
+    lists[i] = parse_ospec( specs[i], 0, priorities,
+                            ( i < sizeof( limits ) ) ? limits[i] : 0 );
+}
+
+varargs mixed *
+parse_ospecs(string *specs, string priorities, int *limits)
+{
+  mixed *lists;
+  string err;
+
+  if( !pointerp( specs ) )
+    return 0;
+
+  if( !stringp( priorities ) )
+    priorities = default_priorities;
+
+  lists = allocate( sizeof( specs ) );
+  if( !memo_depth && !query( "memo", DATASPACE ) )
+  {
+    parse_each( specs, priorities, lists, limits );
+    return lists;
+  }
+
+  if( !memo_depth++ )
+    memo = ([ ]);
+  err = catch( parse_each( specs, priorities, lists, limits ) );
+  if( !--memo_depth )
+    memo = 0;
+  if( err )
+    raise_error( err );
+  return lists;
+}
+
+/*------------------------- evaluate_object_spec ---------------------------*/
+/*
+    Description:
+      Opie conformant access point.
+    Parameters:
+      ospec  - An object specification string.
+      tool   - The tool that is passing us this spec.
+      priorities - The priority string for DWIM terms, or 0.
+      limit  - If nonzero, at most this many objects are wanted.
+    Returns:
+      An array of objects referred to by ospec.
+    Notes:
+      Opie passes a limit of 1 from opie1().
+*/
+varargs object *
+evaluate_object_spec(string ospec, object tool, string priorities, int limit)
+{
+  return parse_ospec(ospec, 0, priorities, limit);
+}
+
+/*------------------------ evaluate_object_specs --------------------------*/
+/*
+    Description:
+      Opie conformant access point for a batch of specs.
+    Parameters:
+      specs  - An array of object specification strings.
+      tool   - The tool that is passing us these specs.
+      priorities - The priority string for DWIM terms, or 0.
+      limits - Each spec's limit, or 0 for none.
+    Returns:
+      Same as parse_ospecs().
+    Notes:
+      Called by Opie's opie_many().
+*/
+varargs mixed *
+evaluate_object_specs(string *specs, object tool, string priorities,
+                      int *limits)
+{
+  return parse_ospecs(specs, priorities, limits);
+}
+
+/*----------------------------- profile_ospec ---------------------------*/
+/*
+    Description:
+      Evaluates an ospec like parse_ospec(), keeping track of where the
+      time goes.
+    Parameters:
+      Same as parse_ospec().
+    Returns:
+      ({ objects, rows }), where objects is what parse_ospec() would
+      have returned, and rows has one mapping per term that was run:
+
+        "depth"    - 0 for the spec itself, 1 for a spec nested in it...
+        "subspec"  - which subspec the term is in, counting from 0
+        "term"     - the text of the term
+        "kind"     - how it was parsed: exact_matches, number_prefix,
+                     string_prefix, normal_op, index, file, nested,
+                     set_ops for a run of +, != and == terms, or
+                     find_targets for DWIM
+        "streamed" - nonzero if it was evaluated one object at a time
+        "in"       - how many objects went into it
+        "out"      - how many objects came out
+        "eval"     - eval cost it used
+        "usecs"    - wall time it took, in microseconds
+
+      The first row has kind "plan" and covers looking up (or
+      compiling) the spec.
+    Notes:
+      Terms that were streamed together share a row.  Eval cost and
+      time of a nested spec (from a (spec) term, a set op, a value in
+      f. or sort., or a mapfile) are also counted in the row of the
+      term that contains it, so only depth 0 rows add up to the total.  Wall time is only good to the second if the
+      driver has no utime().
+*/
+varargs mixed *
+profile_ospec(string ospec, object *prev, string priorities, int limit)
+{
+  mixed *rows, *mark, *plan;
+  object *list;
+  string err;
+
+  if(!stringp(ospec) || !strlen(ospec))
+    return ({ 0, ({ }) });
+
+  if( !stringp( priorities ) )
+    priorities = default_priorities;
+
+  profile_rows = ({ });
+  profile_depth = 0;
+  profile_subspec = 0;
+
+  mark = profile_mark( ({ }) );
+  plan = query_ospec_plan( ospec, priorities );
+  profile_step( mark, ({ make_step( 0, 0, "plan", ospec ) }), plan );
+
+  err = catch( list = record_result( run_plan( plan, prev, priorities,
+                                               limit ) ) );
+  rows = profile_rows;
+  profile_rows = 0;
+  if( err )
+    raise_error( err );
+
+  return ({ list, rows });
+}
+
+/*------------------------- profile_object_spec ---------------------------*/
+/*
+    Description:
+      Opie conformant access point for profile_ospec().
+    Parameters:
+      Same as evaluate_object_spec().
+    Returns:
+      Same as profile_ospec().
+    Notes:
+      Called by Opie's profile().
+*/
+varargs mixed *
+profile_object_spec(string ospec, object tool, string priorities, int limit)
+{
+  return profile_ospec(ospec, 0, priorities, limit);
+}
+
+/*----------------------------- stream_one ---------------------------*/
+/*
+    Description:
+      Applies one streamable step to a single object.
+    Parameters:
+      ob   - An object
+      step - A step with a STEP_STREAM
+    Returns:
+      An array of the objects ob turns into.
+    Notes:
+      Used by async_run() to split a step across call_outs.
+*/
+static object *
+stream_one( object ob, mixed *step )
+{
+  mixed items;
+
+  if( !objectp( ob ) )
+    return ({ });
+  if( step[STEP_STREAM] == LAZY_DEEP )
+    return deep_inventory( ob );
+  items = funcall( step[STEP_STREAM], ob, step[STEP_ARG] );
+  if( pointerp( items ) )
+    return filter_array( items, #'objectp );
+  return objectp( items ) ? ({ items }) : ({ });
+}
+
+/*----------------------------- async_run ---------------------------*/
+/*
+    Description:
+      Works on an asynchronous spec until it's done or the slice's
+      eval budget is used up.
+    Parameters:
+      job   - An entry from async_jobs
+      start - get_eval_cost() at the start of the slice
+    Returns:
+      True if the spec is finished.
+    Notes:
+      Streamable steps are split between slices object by object.
+      Any other step is done in one go, so one huge non-streamable
+      term can still run out of evals.  Nested specs in a term are
+      evaluated right away, not in slices.
+*/
+static status
+async_run( mixed *job, int start )
+{
+  mixed *steps, *step, mtmp;
+  object *prev;
+  int size;
+
+  while( job[AJ_SUBSPEC] < sizeof( job[AJ_PLAN] ) )
+  {
+    steps = job[AJ_PLAN][job[AJ_SUBSPEC]];
+    if( job[AJ_STEP] >= sizeof( steps ) )
+    {
+      // Joined like run_plan() does, so both give the same set.
+      job[AJ_LIST] = set_union( ({ job[AJ_LIST], job[AJ_PREV] }) );
+      job[AJ_SUBSPEC]++;
+      job[AJ_STEP] = 0;
+      job[AJ_PREV] = ({ job[AJ_USER] });
+      job[AJ_FIRST] = 1;
+      continue;
+    }
+
+    if( start - get_eval_cost() >= job[AJ_BUDGET] )
+      return 0;
+
+    step = steps[job[AJ_STEP]];
+    if( !job[AJ_POS] )
+    {
+      job[AJ_PREV] = filter_array( job[AJ_PREV], #'objectp );
+      job[AJ_OUT] = allocate( sizeof( job[AJ_PREV] ) );
+    }
+    prev = job[AJ_PREV];
+
+    if( step[STEP_STREAM] )
+    {
+      for( size = sizeof( prev ); job[AJ_POS] < size; job[AJ_POS]++ )
+      {
+        if( start - get_eval_cost() >= job[AJ_BUDGET] )
+          return 0;
+        job[AJ_OUT][job[AJ_POS]] = stream_one( prev[job[AJ_POS]], step );
+      }
+      prev = flatten_array1( job[AJ_OUT] );
+    } else
+    {
+      mtmp = funcall( step[STEP_CL], prev, step[STEP_ARG], job[AJ_FIRST],
+                      job[AJ_PRIORITIES] );
+      prev = pointerp(mtmp) ? mtmp : ({ mtmp });
+    }
+
+    job[AJ_PREV] = prev;
+    job[AJ_OUT] = 0;
+    job[AJ_POS] = 0;
+    job[AJ_FIRST] = 0;
+    job[AJ_STEP]++;
+  }
+  return 1;
+}
+
+/*----------------------------- async_slice ---------------------------*/
+/*
+    Description:
+      One call_out's worth of work on an asynchronous spec.
+    Parameters:
+      handle - from parse_ospec_async()
+    Returns:
+      Nothing.
+    Notes:
+      Calls the callback when the spec is done, or if it fails.
+*/
+static void
+async_slice( int handle )
+{
+  mixed *job;
+  string err;
+  status done;
+
+  if( !( job = async_jobs[handle] ) )
+    return;
+
+  job[AJ_SLICES]++;
+  if( err = catch( done = async_run( job, get_eval_cost() ) ) )
+  {
+    m_delete( async_jobs, handle );
+    funcall( job[AJ_CALLBACK], 0, handle, err );
+    return;
+  }
+
+  if( !done )
+  {
+    call_out( "async_slice", 0, handle );
+    return;
+  }
+
+  m_delete( async_jobs, handle );
+  funcall( job[AJ_CALLBACK], record_result( job[AJ_LIST] ), handle );
+}
+
+/*----------------------------- parse_ospec_async ---------------------------*/
+/*
+    Description:
+      Evaluates an ospec a little at a time, for specs too big to do
+      in one execution.
+    Parameters:
+      ospec      - An object specification string.
+      callback   - Called as callback(objects, handle) when it's done,
+                   or as callback(0, handle, error) if it fails.
+      priorities - The priority string for DWIM terms, or 0.
+      budget     - Eval cost to use per slice, or 0 for the default.
+    Returns:
+      A handle for query_ospec_async() and cancel_ospec_async(), or 0
+      if ospec is empty or callback isn't a closure.
+    Notes:
+      The spec is compiled right away and evaluated in call_outs from
+      this object, each of which stops once it has used up <budget>.
+      Terms that work on one object at a time (I, i, e, s, f., ...)
+      can be split between call_outs; others run in a single one.
+      Will set "$" and friends when it finishes, like parse_ospec().
+*/
+varargs int
+parse_ospec_async(string ospec, closure callback, string priorities,
+                  int budget)
+{
+  mixed *job;
+
+  if(!stringp(ospec) || !strlen(ospec) || !closurep(callback))
+    return 0;
+
+  if( !stringp( priorities ) )
+    priorities = default_priorities;
+
+  job = allocate( AJ_SIZE );
+  job[AJ_PLAN]       = query_ospec_plan( ospec, priorities );
+  job[AJ_PRIORITIES] = priorities;
+  job[AJ_CALLBACK]   = callback;
+  job[AJ_OWNER]      = previous_object() || THISO;
+  job[AJ_USER]       = THISP;
+  job[AJ_BUDGET]     = ( budget > 0 ) ? budget : ASYNC_BUDGET;
+  job[AJ_PREV]       = ({ THISP });
+  job[AJ_FIRST]      = 1;
+  job[AJ_LIST]       = ({ });
+
+  async_jobs[++async_counter] = job;
+  call_out( "async_slice", 0, async_counter );
+  return async_counter;
+}
+
+/*----------------------------- query_ospec_async ---------------------------*/
+/*
+    Description:
+      Tells how far along an asynchronous spec is.
+    Parameters:
+      handle - from parse_ospec_async()
+    Returns:
+      0 if it's finished or cancelled, or a mapping of:
+        "subspec", "subspecs" - the subspec being run, and how many
+        "term", "terms"       - the term being run, and how many
+        "position", "of"      - how far through its list a streamed
+                                term is
+        "found"               - objects found by finished subspecs
+        "slices"              - call_outs used so far
+    Notes:
+      None.
+*/
+mapping
+query_ospec_async( int handle )
+{
+  mixed *job;
+
+  if( !( job = async_jobs[handle] ) )
+    return 0;
+
+  return ([ "subspec"  : job[AJ_SUBSPEC],
+            "subspecs" : sizeof( job[AJ_PLAN] ),
+            "term"     : job[AJ_STEP],
+            "terms"    : ( job[AJ_SUBSPEC] < sizeof( job[AJ_PLAN] ) )
+                         ? sizeof( job[AJ_PLAN][job[AJ_SUBSPEC]] ) : 0,
+            "position" : job[AJ_POS],
+            "of"       : sizeof( job[AJ_PREV] ),
+            "found"    : sizeof( job[AJ_LIST] ),
+            "slices"   : job[AJ_SLICES] ]);
+}
+
+/*----------------------------- cancel_ospec_async ---------------------------*/
+/*
+    Description:
+      Gives up on an asynchronous spec.
+    Parameters:
+      handle - from parse_ospec_async()
+    Returns:
+      1 if it was cancelled, 0 if there was no such spec or it's
+      someone else's.
+    Notes:
+      The callback is not called.
+*/
+status
+cancel_ospec_async( int handle )
+{
+  mixed *job;
+
+  if( !( job = async_jobs[handle] ) )
+    return 0;
+
+  if( ( previous_object() != job[AJ_OWNER] ) && ( THISP != job[AJ_USER] ) )
+    return 0;
+
+  m_delete( async_jobs, handle );
+  return 1;
+}
+
+/*------------------------- refine_object_spec ---------------------------*/
+/*
+    Description:
+      Opie conformant access point for narrowing down a list.
+    Parameters:
+      ospec  - More terms, as if they came after the spec that made prev.
+      prev   - The list to start from.
+      tool   - The tool that is passing us this spec.
+      priorities - The priority string for DWIM terms, or 0.
+    Returns:
+      An array of objects.
+    Notes:
+      Called by Opie's refine() on a stored result set.  Each subspec
+      of ospec starts from prev, so "f.living,id.sword" keeps the
+      living things and the swords.
+*/
+varargs object *
+refine_object_spec(string ospec, object *prev, object tool, string priorities)
 {
-  return parse_ospec(ospec, 0, priorities);
+  return parse_ospec(ospec, pointerp(prev) ? prev : ({ }), priorities);
 }
 
 /*----------------------------- object_spec_help ---------------------------*/
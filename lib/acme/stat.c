@@ -160,8 +160,8 @@ mode( float *sample )
   if( !valid_sample( &sample ) )
     raise_error( "Bad argument 1 to mode()\n" );
   freq_map = freq(sample);
-  return sort_alist( ({ m_values( freq_map ), m_indices( freq_map ) }), 
-                     #'> )[1][0];
+  return m_indices( freq_map )[
+           sort_permutation( m_values( freq_map ), #'< )[0] ];
 }
  
 /*--------------------------------- high --------------------------------*/
@@ -173,14 +173,14 @@ mode( float *sample )
     Returns:
       The highest value in the sample.
     Notes:
-      None.
+      One pass; see min_max().
 */
 float
 high( float *sample )
 {
   if( !valid_sample( &sample ) )
-    raise_error( "Bad argument 1 to mode()\n" );
-  return sort_array( sample, #'< )[0];
+    raise_error( "Bad argument 1 to high()\n" );
+  return min_max( sample )[1];
 }
  
 /*--------------------------------- low --------------------------------*/
@@ -192,14 +192,14 @@ high( float *sample )
     Returns:
       The lowest value in the sample.
     Notes:
-      None.
+      One pass; see min_max().
 */
 float
 low( float *sample )
 {
   if( !valid_sample( &sample ) )
-    raise_error( "Bad argument 1 to mode()\n" );
-  return sort_array( sample, #'> )[0];
+    raise_error( "Bad argument 1 to low()\n" );
+  return min_max( sample )[0];
 }
  
 /*----------------------------- first_quartile --------------------------*/
@@ -318,7 +318,8 @@ iqr( float *sample )
       Returns the value for which percentile percent of the samples
       fall beneath it.
     Notes:
-      None.
+      Picks out the one or two samples it needs with nth_element(),
+      rather than sorting the whole sample.
 */
  
 // highest I can go without overflowing
@@ -335,7 +336,6 @@ percentile( float *sample, float p )
     raise_error( "Bad argument 1 to percentile()\n" );
   if( !valid_sample( &sample ) )
     raise_error( "Bad argument 1 to percentile()\n" );
-  sample = sort_array( sample, #'> );
  
   size = sizeof( sample );
   step = 100.0 / ( size - 1 );
@@ -344,12 +344,12 @@ percentile( float *sample, float p )
   ip = to_int( p * MOD );
  
   lower = to_float( ip - ip%istep ) / MOD;
-  lelem = sample[ to_int( lower / step ) ];
+  lelem = nth_element( sample, to_int( lower / step ), #'> );
   if( lower == p )
     return lelem;
  
   upper = lower + step;
-  uelem = sample[ to_int( upper / step ) ];
+  uelem = nth_element( sample, to_int( upper / step ), #'> );
   pstep = p - lower;
   delem = uelem - lelem;
   diff = ( ( pstep * delem ) + ( step * lelem ) ) / step;
@@ -420,16 +420,20 @@ mapping rel_freq( float *sample )
 mapping cum_rel_freq( float *sample )
 {
   mapping crf_map;
-  mixed *crf_alist;
+  float *values, *freqs;
+  int *perm;
   int i, j;
   if( !valid_sample( &sample ) )
     raise_error( "Bad argument 1 to cum_rel_freq()\n" );
   crf_map = rel_freq( sample );
-  crf_alist = ({ m_indices( crf_map ), m_values( crf_map ) });
-  crf_alist = sort_alist( crf_alist, #'> );
-  for( i=1, j=sizeof(crf_alist[0]); i<j; i++ )
-    crf_alist[1][i] += crf_alist[1][i-1];
-  crf_map = mkmapping( crf_alist[0], crf_alist[1] );
+  values = m_indices( crf_map );
+  freqs = m_values( crf_map );
+  perm = sort_permutation( values, #'> );
+  apply_permutation( values, perm );
+  apply_permutation( freqs, perm );
+  for( i=1, j=sizeof(freqs); i<j; i++ )
+    freqs[i] += freqs[i-1];
+  crf_map = mkmapping( values, freqs );
   return crf_map;
 }
  
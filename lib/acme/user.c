@@ -13,12 +13,19 @@
                                list or from all users
 
     NOTES
+        Asking for a range of levels out of all users is answered by
+        the AcmeUserIndex daemon, which keeps the connected users
+        bucketed by OrdLevel, in time proportional to the number of
+        users returned.  Filtering a given list asks each user with
+        GetOrdLevel(), so a promotion counts right away.
 
     LAST MODIFIED
         Zamboni 960229
 
 */
 
+#include <acme.h>
+
 private static closure filter_by_hostname_cl;
 
 /*------------------------------- level_range -------------------------------*/
@@ -28,29 +35,32 @@ private static closure filter_by_hostname_cl;
       For example, level_range(users(), OrdLevel(Guest), OrdLevel(God))
       would return an array containing all the wizards online.
     Parameters: 
-      ulist     - array of some users
+      ulist     - array of some users, or 0 for all users
       min       - minimum OrdLevel of users to keep
       max       - maximum OrdLevel of users to keep
     Returns:
       New array of all users in <folks> who were within the range specified
     Notes: 
-      None.
+      If ulist is 0, the answer comes straight out of the user index.
 */
 object *
 level_range(object *ulist, int min, int max)
 {
-  int i, size, ol;
+  int i, j, size, ol;
   object *newlist;
 
+  if(!ulist)
+    return AcmeUserIndex->query_level_range(min, max);
+
   if(!pointerp(ulist) || !(size = sizeof(ulist)))
     return 0;
   
-  newlist = ({ });
+  newlist = allocate(size);
   for(i=0; i < size; i++)
     if(((ol = GetOrdLevel(ulist[i])) >= min)
        && (ol <= max))
-      newlist += ({ ulist[i] });
-  return newlist;
+      newlist[j++] = ulist[i];
+  return newlist[0..j-1];
 }
 
 /*---------------------------- level_range_fast -----------------------------*/
@@ -127,24 +137,46 @@ make_hostname_closure()
 }
 
 
+// ".stanford.edu": a domain, asked for as a suffix by the leading '.'
+private status
+domain_suffix(string pattern)
+{
+  return sizeof(regexp(({ pattern }),
+                       "^(\\.[A-Za-z0-9-]+)+$"))
+         && sizeof(regexp(({ pattern }), "[A-Za-z]"));
+}
+
 /*-------------------------- filter_by_hostname ---------------------------*/
 /*
     Description: 
       Filter a list of users by a hostname regexp.
     Parameters: 
-      ulist     - array of some objects, usually players
+      ulist     - array of some objects, usually players, or 0 for all users
+      pattern   - a regexp, or a domain suffix like ".stanford.edu"
     Returns:
       A list of everything in ulist that was interactive and whose
       hostname was matched by <pattern>.
     Notes: 
-      None.
+      A pattern is a regexp on the lower-cased hostname, so "aol"
+      matches anywhere in it.  A domain with a leading '.' instead
+      matches hostnames that are that domain or end in "."+domain,
+      and is answered by the user index without looking at every
+      user.
 */
 object *
 filter_by_hostname(object *ulist, string pattern)
 {
+  object *matches;
+
+  if(stringp(pattern) && domain_suffix(pattern))
+  {
+    matches = AcmeUserIndex->query_host_suffix(pattern[1..]);
+    return ulist ? ulist & matches : matches;
+  }
+
   if(!closurep(filter_by_hostname_cl))
     make_hostname_closure();
-  return filter_array( ulist, filter_by_hostname_cl, pattern );
+  return filter_array( ulist || users(), filter_by_hostname_cl, pattern );
 }
 
 /*-------------------------- wizards ---------------------------*/
@@ -162,7 +194,7 @@ varargs object *
 wizards(object *ulist)
 {
   if(!ulist)
-    ulist = users();
+    return level_range( 0, 1, 99 );
   return level_range_fast( ulist, 1, 99 );
 }
 
@@ -181,6 +213,6 @@ varargs object *
 mortals(object *ulist)
 {
   if(!ulist)
-    ulist = users();
+    return level_range( 0, 0, 0 );
   return level_range_fast( ulist, 0, 0 );
 }
@@ -0,0 +1,463 @@
+/*
+** Library benchmark
+**
+** Times some AcmeArray, AcmeStrings and AcmeArgs functions on inputs
+** of 10 to 100000 elements (or characters) that are the same every
+** run, and works out how their cost grows with the size of the input.
+** For each function, input shape and size it reports:
+**
+**   eval   - eval cost of one call
+**   usecs  - wall time of one call (to the second only, if the
+**            driver has no utime())
+**
+** and for each function and shape the slope of log(eval) against
+** log(size), by least squares: about 1 is linear, 2 quadratic.
+**
+** Usage:   "/zone/null/acme/bench/lib_bench.c"->run()
+**          "/zone/null/acme/bench/lib_bench.c"->run(file)
+**          "/zone/null/acme/bench/lib_bench.c"->save_baseline()
+**
+** The report goes to file (default results/lib.<time>).  The first
+** report is kept as lib_baseline, and later ones list anything whose
+** eval cost went up by more than REGRESSION percent, or whose slope
+** went up by more than SLOPE_SLACK, since then.  Eval cost doesn't
+** depend on how busy the machine is, so that's what gets compared.
+** save_baseline() makes the last report the baseline, for after a
+** change that's meant to make things slower (or did make them faster).
+**
+** Each measurement is done in its own call_out, so one that runs out
+** of evals doesn't stop the rest; the bigger sizes of that function
+** are skipped.  Array inputs bigger than MAX_ARRAY_SIZE are skipped.
+*/
+
+#include <acme.h>
+#include <driver_config.h>
+
+#include AcmeArrayInc
+#include AcmeStringsInc
+#include AcmeArgsInc
+
+inherit AcmeArray;
+inherit AcmeStrings;
+inherit AcmeArgs;
+
+#define BenchDir      AcmeDir "bench/"
+#define ResultDir     BenchDir "results/"
+#define Baseline      BenchDir "lib_baseline"
+
+#define SIZES         ({ 10, 100, 1000, 10000, 100000 })
+#define REGRESSION    25      // percent more eval cost that's a regression
+#define SLOPE_SLACK   0.2     // this much steeper growth is a regression
+
+// cases[i] = ({ function, shape, generator, call, is_array })
+//   generator - closure(size) that makes the input
+//   call      - closure(input) that calls the function
+#define C_NAME        0
+#define C_SHAPE       1
+#define C_MAKE        2
+#define C_CALL        3
+#define C_ARRAY       4
+
+static mixed *cases;
+
+// Where a run is, and what it has found so far.
+static int case_no, size_no;
+static status running;
+static string out;
+static object user;
+static mapping evals;     // "function shape" : ({ cost at each size })
+static mapping usecs;     // "function shape" : ({ time at each size })
+
+static void finish();
+
+//---------------------------------- inputs ---------------------------------//
+
+// Numbers spread out over 0..size-1, the same every run.
+static int *
+make_ints( int size )
+{
+  int *arr, i;
+  arr = allocate( size );
+  for( i = 0; i < size; i++ )
+    arr[i] = ( i * 7919 ) % size;
+  return arr;
+}
+
+// About half of these are duplicates.
+static int *
+make_dups( int size )
+{
+  int *arr, i;
+  arr = allocate( size );
+  for( i = 0; i < size; i++ )
+    arr[i] = ( i * 7919 ) % ( size / 2 + 1 );
+  return arr;
+}
+
+// size numbers, nested depth arrays deep, in chunks of 4.
+static mixed
+make_nested( int size, int depth )
+{
+  mixed *arr;
+  int i, n;
+
+  if( size <= 0 )
+    return ({ });
+  if( depth <= 1 || size <= 4 )
+    return make_ints( size );
+  n = ( size + 3 ) / 4;
+  arr = allocate( 4 );
+  for( i = 0; i < 4; i++ )
+    arr[i] = make_nested( ( i < 3 ) ? n : size - 3 * n, depth - 1 );
+  return arr;
+}
+
+// A string of about size characters with an escape every <every>.
+static string
+make_escaped( int size, int every )
+{
+  string str, chunk;
+  chunk = sprintf( "%*s\\n", every - 2, "" );
+  str = "";
+  while( strlen( str ) < size )
+    str += chunk;
+  return str[0..size-1];
+}
+
+// A string of about size characters with a color change every <every>.
+static string
+make_ansi( int size, int every )
+{
+  string str, chunk;
+  chunk = sprintf( "%c[1m%*s", 27, every - 4, "" );
+  str = "";
+  while( strlen( str ) < size )
+    str += chunk;
+  return str;
+}
+
+// A string of about size characters of terms like a:b(c:d), nested
+// depth parentheses deep.
+static string
+make_spec( int size, int depth )
+{
+  string term, str;
+  int i;
+
+  term = "x";
+  for( i = 1; i < depth; i++ )
+    term = "f(" + term + ":y)";
+  str = "";
+  while( strlen( str ) < size )
+    str += term + ":";
+  return str;
+}
+
+// A string of about size characters with a $variable every <every>.
+static string
+make_vars( int size, int every )
+{
+  string str, chunk;
+  chunk = sprintf( "%*s$HOME", every - 5, "" );
+  str = "";
+  while( strlen( str ) < size )
+    str += chunk;
+  return str;
+}
+
+//---------------------------------- cases ----------------------------------//
+
+static void
+add_case( string name, string shape, closure make, closure call,
+          status is_array )
+{
+  cases += ({ ({ name, shape, make, call, is_array }) });
+}
+
+static void
+make_cases()
+{
+  int i;
+  int *depths, *every;
+
+  cases = ({ });
+  depths = ({ 2, 4, 8 });
+  every = ({ 8, 16, 64 });
+
+  for( i = 0; i < sizeof( depths ); i++ )
+    add_case( "flatten_array", "depth " + depths[i],
+              lambda( ({ 'n }), ({ #'make_nested, 'n, depths[i] }) ),
+              #'flatten_array, 1 );
+  add_case( "flatten_array1", "depth 2",
+            lambda( ({ 'n }), ({ #'make_nested, 'n, 2 }) ),
+            #'flatten_array1, 1 );
+  add_case( "unique_array_slow", "half dups", #'make_dups,
+            #'unique_array_slow, 1 );
+  add_case( "exclude_array", "minus half",
+            lambda( ({ 'n }),
+                    ({ #'({, ({ #'make_ints, 'n }), ({ #'make_dups, 'n }) }) ),
+            lambda( ({ 'a }),
+                    ({ #'exclude_array, ({ #'[, 'a, 0 }),
+                                        ({ #'[, 'a, 1 }) }) ), 1 );
+  add_case( "sort_alist", "2 columns",
+            lambda( ({ 'n }),
+                    ({ #'({, ({ #'make_ints, 'n }), ({ #'make_dups, 'n }) }) ),
+            lambda( ({ 'a }), ({ #'sort_alist, 'a, #'> }) ), 1 );
+
+  for( i = 0; i < sizeof( depths ); i++ )
+    add_case( "explode_nested", "depth " + depths[i],
+              lambda( ({ 'n }), ({ #'make_spec, 'n, depths[i] }) ),
+              lambda( ({ 's }), ({ #'explode_nested, 's, ":" }) ), 0 );
+
+  for( i = 0; i < sizeof( every ); i++ )
+  {
+    add_case( "expand_unescape", "1 in " + every[i],
+              lambda( ({ 'n }), ({ #'make_escaped, 'n, every[i] }) ),
+              #'expand_unescape, 0 );
+    add_case( "expand_variables", "1 in " + every[i],
+              lambda( ({ 'n }), ({ #'make_vars, 'n, every[i] }) ),
+              lambda( ({ 's }),
+                      ({ #'expand_variables, 's,
+                         ([ "HOME" : "/usr/someone",
+                            "PWD"  : "/zone/null" ]) }) ), 0 );
+    add_case( "remove_ansi", "1 in " + every[i],
+              lambda( ({ 'n }), ({ #'make_ansi, 'n, every[i] }) ),
+              #'remove_ansi, 0 );
+  }
+}
+
+//--------------------------------- measuring -------------------------------//
+
+static int *
+wall_clock()
+{
+#if __EFUN_DEFINED__(utime)
+  return utime();
+#else
+  return ({ time(), 0 });
+#endif
+}
+
+/*
+** Slope of log(y) against log(x), by least squares, over the points
+** where y is positive.  Returns -1.0 if there aren't two of them.
+*/
+static float
+growth( int *x, int *y )
+{
+  float sx, sy, sxx, sxy, lx, ly, d;
+  int i, n;
+
+  sx = sy = sxx = sxy = 0.0;
+  for( i = 0; i < sizeof( y ); i++ )
+  {
+    if( y[i] <= 0 )
+      continue;
+    lx = log( to_float( x[i] ) );
+    ly = log( to_float( y[i] ) );
+    sx += lx;
+    sy += ly;
+    sxx += lx * lx;
+    sxy += lx * ly;
+    n++;
+  }
+  if( n < 2 || ( d = n * sxx - sx * sx ) == 0.0 )
+    return -1.0;
+  return ( n * sxy - sx * sy ) / d;
+}
+
+/*
+** Time one case at one size.  Returns ({ eval, usecs }).
+*/
+static int *
+measure( mixed *c, int size )
+{
+  mixed input;
+  int *start, *stop;
+  int eval;
+
+  input = funcall( c[C_MAKE], size );
+  start = wall_clock();
+  eval = get_eval_cost();
+  funcall( c[C_CALL], input );
+  eval -= get_eval_cost();
+  stop = wall_clock();
+  return ({ eval, ( stop[0] - start[0] ) * 1000000 + stop[1] - start[1] });
+}
+
+static void
+next_measurement()
+{
+  mixed *c;
+  string key, err;
+  int *res, size;
+
+  c = cases[case_no];
+  key = c[C_NAME] + " " + c[C_SHAPE];
+  size = SIZES[size_no];
+
+  if( c[C_ARRAY] && size > MAX_ARRAY_SIZE )
+    err = "too big";
+  else
+    err = catch( res = measure( c, size ) );
+
+  if( err )
+  {
+    write_file( out, sprintf( "%-18s %-12s %7d  %s", c[C_NAME], c[C_SHAPE],
+                              size, ( err[<1] == '\n' ) ? err : err + "\n" ) );
+    size_no = sizeof( SIZES );   // skip the bigger ones
+  }
+  else
+  {
+    evals[key][size_no] = res[0];
+    usecs[key][size_no] = res[1];
+    write_file( out, sprintf( "%-18s %-12s %7d %10d %10d\n",
+                              c[C_NAME], c[C_SHAPE], size, res[0], res[1] ) );
+    size_no++;
+  }
+
+  if( size_no >= sizeof( SIZES ) )
+  {
+    size_no = 0;
+    if( ++case_no >= sizeof( cases ) )
+    {
+      finish();
+      return;
+    }
+  }
+  call_out( "next_measurement", 0 );
+}
+
+//--------------------------------- reporting -------------------------------//
+
+/*
+** Read the growth lines back from a report:
+**   "function shape" : ({ slope, eval at each size... })
+*/
+static mapping
+read_summary( string file )
+{
+  mapping sum;
+  string *lines, *f;
+  int i;
+
+  sum = ([ ]);
+  lines = explode( read_file( file ) || "", "\n" );
+  for( i = 0; i < sizeof( lines ); i++ )
+    if( sizeof( f = explode( lines[i], "|" ) ) >= 4 && f[0] == "growth" )
+      sum[f[1]] = ({ to_float( f[2] ) }) +
+        map_array( explode( f[3], " " ) - ({ "" }), #'to_int );
+  return sum;
+}
+
+static void
+finish()
+{
+  mapping base;
+  string *keys, line;
+  mixed *was;
+  float slope;
+  int i, j, n;
+
+  running = 0;
+  base = ( file_size( Baseline ) > 0 ) ? read_summary( Baseline ) : 0;
+
+  write_file( out, "\n# growth|function shape|slope|eval at each size|"
+                   "wall time slope\n" );
+  keys = sort_array( m_indices( evals ), #'> );
+  for( i = 0; i < sizeof( keys ); i++ )
+  {
+    slope = growth( SIZES, evals[keys[i]] );
+    write_file( out, sprintf( "growth|%s|%.2f|%s|%.2f\n", keys[i],
+                              slope, implode( map_array( evals[keys[i]],
+                                                         #'to_string ), " " ),
+                              growth( SIZES, usecs[keys[i]] ) ) );
+    if( !base || !( was = base[keys[i]] ) )
+      continue;
+
+    if( ( was[0] >= 0.0 ) && ( slope > was[0] + SLOPE_SLACK ) )
+      line = sprintf( "grows faster: slope %.2f, was %.2f", slope, was[0] );
+    else
+      line = 0;
+    for( j = 1; j < sizeof( was ) && j <= sizeof( SIZES ); j++ )
+      if( was[j] > 0 && ( n = evals[keys[i]][j-1] ) > 0
+          && ( n - was[j] ) * 100 > was[j] * REGRESSION )
+      {
+        line = ( line ? line + "; " : "" )
+          + sprintf( "%d costs %d, was %d", SIZES[j-1], n, was[j] );
+        break;
+      }
+    if( line )
+      write_file( out, sprintf( "REGRESSION %s: %s\n", keys[i], line ) );
+  }
+
+  if( !base )
+  {
+    write_file( Baseline, read_file( out ) );
+    write_file( out, "# no baseline yet; this run is now the baseline\n" );
+  }
+
+  if( user )
+    tell_object( user, "Library benchmark done: " + out + "\n" );
+}
+
+//----------------------------------- entry ---------------------------------//
+
+create()
+{
+  seteuid( getuid() );
+}
+
+/*
+** Start a run, with the report going to file (default
+** results/lib.<time>).  Returns 0 if one is already going.
+*/
+varargs status
+run( string file )
+{
+  int i;
+
+  if( running )
+    return 0;
+
+  if( !file )
+  {
+    if( file_size( ResultDir ) != -2 )
+      mkdir( ResultDir );
+    file = ResultDir + "lib." + time();
+  }
+  out = file;
+  user = THISP;
+  running = 1;
+  case_no = size_no = 0;
+
+  make_cases();
+  evals = ([ ]);
+  usecs = ([ ]);
+  for( i = 0; i < sizeof( cases ); i++ )
+  {
+    evals[cases[i][C_NAME] + " " + cases[i][C_SHAPE]] = allocate( sizeof( SIZES ) );
+    usecs[cases[i][C_NAME] + " " + cases[i][C_SHAPE]] = allocate( sizeof( SIZES ) );
+  }
+
+  write_file( out, sprintf( "# Library benchmark, driver %s, %s\n"
+                            "%-18s %-12s %7s %10s %10s\n",
+                            __VERSION__, ctime( time() ),
+                            "function", "shape", "size", "eval", "usecs" ) );
+  call_out( "next_measurement", 0 );
+  return 1;
+}
+
+/*
+** Make the report from the last run the baseline.  Do this after a
+** change that makes things faster, or that's meant to make them slower.
+*/
+status
+save_baseline()
+{
+  if( running || !out || file_size( out ) <= 0 )
+    return 0;
+  if( file_size( Baseline ) >= 0 )
+    rm( Baseline );
+  return write_file( Baseline, read_file( out ) );
+}
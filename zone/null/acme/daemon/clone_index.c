@@ -0,0 +1,281 @@
+/*
+    NAME
+
+        clone_index.c - Acme Clone Index
+
+    DESCRIPTION
+
+        Keeps track of the live clones of programs, so that "all clones
+        of /obj/weapon/sword" is a mapping lookup instead of a
+        find_objects() scan.
+
+        The list is kept up to date by register_clone() and
+        unregister_clone(), which a base object can call from its
+        create() and its destruct handling, and by rescanning every
+        watched program, one per call_out, every RECONCILE_TIME
+        seconds.  Until a program's clones call register_clone(),
+        nothing would tell the index about new ones, so its clones are
+        found with find_objects() every time they're asked for, as
+        before there was an index.  Destructed clones are never
+        returned.
+
+      API
+
+        query_clones()      - all the live clones of a program
+        register_clone()    - hook: the calling clone was just created
+        unregister_clone()  - hook: the calling clone is going away
+        query_watched()     - the programs being kept track of
+
+    NOTES
+
+        The hooks only ever register or unregister previous_object(),
+        so nothing can put an arbitrary object into the index, and
+        rescans are only started by the index itself.  No base object
+        in this tree calls the hooks yet, so until one does, the index
+        is no faster than find_objects().
+        Programs are named like find_objects() names them: no leading
+        '/' and no ".c".  Only the MAX_WATCHED most recently asked
+        about programs are kept.
+
+*/
+
+#include <acme.h>
+#include AcmeCloneIndexInc
+
+#include <driver_config.h>
+
+#define RECONCILE_TIME  300
+#define MAX_WATCHED     256
+
+private static mapping clones;   // program : ([ clone : 1 ])
+private static mapping asked;    // program : time() last queried
+private static string *queue;    // programs left to rescan this round
+private static mapping hooked;   // program : 1 once its clones register
+
+
+//---------------------------------- index ----------------------------------//
+
+private string
+program_key( string file )
+{
+   if ( !stringp( file ) )
+      return 0;
+   file = explode( file, "#" )[ 0 ];
+   if ( file[ 0..0 ] == "/" )
+      file = file[ 1.. ];
+   if ( file[ <2.. ] == ".c" )
+      file = file[ 0..<3 ];
+   return file;
+}
+
+private void
+forget_oldest()
+{
+   string *keys, oldest;
+   int i, size;
+
+   keys = m_indices( asked );
+   for ( oldest = keys[ 0 ], i = 1, size = sizeof( keys ); i < size; i++ )
+      if ( asked[ keys[ i ] ] < asked[ oldest ] )
+         oldest = keys[ i ];
+   m_delete( asked, oldest );
+   m_delete( clones, oldest );
+   m_delete( hooked, oldest );
+}
+
+/*----------------------------- rescan ---------------------------*/
+/*
+    Description:
+      Finds all the clones of a program from scratch.
+    Parameters:
+      file - the program, like "/obj/weapon/sword"
+    Returns:
+      Nothing.
+    Notes:
+      Uses find_objects() a chunk at a time, like find_inherit().
+      Starts watching the program if it wasn't already.
+*/
+static void
+rescan( string file )
+{
+   mapping found;
+   object *stuff, last_ob;
+   int i, size;
+
+   if ( !( file = program_key( file ) ) )
+      return;
+
+   if ( !member( asked, file ) && sizeof( asked ) >= MAX_WATCHED )
+      forget_oldest();
+   if ( !member( asked, file ) )
+      asked[ file ] = time();
+
+   found = ([ ]);
+   do
+   {
+      stuff = last_ob ? find_objects( file, last_ob ) : find_objects( file );
+      for ( i = 1, size = sizeof( stuff ); i < size; i++ )
+         if ( objectp( stuff[ i ] ) )
+            found[ stuff[ i ] ] = 1;
+      last_ob = ( stuff[ 0 ] && size > 1 ) ? stuff[ <1 ] : 0;
+   }
+   while ( last_ob );
+
+   clones[ file ] = found;
+}
+
+/*----------------------------- reconcile ---------------------------*/
+/*
+    Description:
+      Rescans the next watched program.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      Runs from call_out, so it's static rather than private.
+*/
+static void
+reconcile()
+{
+   while ( remove_call_out( "reconcile" ) != -1 )
+      ;
+
+   if ( !sizeof( queue ) && !sizeof( queue = m_indices( asked ) ) )
+   {
+      call_out( "reconcile", RECONCILE_TIME );
+      return;
+   }
+
+   // One program per call_out, so a big one can't starve the rest.
+   // Programs without the hooks are rescanned on every query anyway.
+   if ( member( asked, queue[ 0 ] ) && hooked[ queue[ 0 ] ] )
+      rescan( queue[ 0 ] );
+   queue = queue[ 1.. ];
+   call_out( "reconcile", sizeof( queue ) ? 1 : RECONCILE_TIME );
+}
+
+
+//---------------------------------- hooks ----------------------------------//
+
+/*----------------------------- register_clone ---------------------------*/
+/*
+    Description:
+      Tells the index a clone was just made.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      Call it from the clone itself, in create().  The first clone of
+      a program to call it makes the index trust its list of that
+      program's clones, once it has been rescanned.
+*/
+void
+register_clone()
+{
+   object ob;
+   string file;
+
+   ob = previous_object();
+   if ( !ob || !clonep( ob ) )
+      return;
+   file = program_key( object_name( ob ) );
+   if ( !hooked[ file ] )
+   {
+      // Clones made before the hooks were wired up never registered,
+      // so the list has to be found again from scratch.
+      hooked[ file ] = 1;
+      m_delete( clones, file );
+   }
+   else if ( mappingp( clones[ file ] ) )
+      clones[ file ][ ob ] = 1;
+}
+
+/*----------------------------- unregister_clone ---------------------------*/
+/*
+    Description:
+      Tells the index a clone is going away.
+    Parameters:
+      None.
+    Returns:
+      Nothing.
+    Notes:
+      Call it from the clone itself, before it's destructed.  Not
+      strictly needed, since destructed clones are dropped anyway, but
+      it keeps the mappings small.
+*/
+void
+unregister_clone()
+{
+   object ob;
+   string file;
+
+   ob = previous_object();
+   if ( !ob )
+      return;
+   file = program_key( object_name( ob ) );
+   if ( mappingp( clones[ file ] ) )
+      m_delete( clones[ file ], ob );
+}
+
+
+//--------------------------------- queries ---------------------------------//
+
+/*----------------------------- query_clones ---------------------------*/
+/*
+    Description:
+      Finds all the live clones of a program.
+    Parameters:
+      file - the program, like "/obj/weapon/sword" or "obj/weapon/sword.c"
+    Returns:
+      An array of clones.
+    Notes:
+      The first time a program is asked about, its clones are found
+      with find_objects().  After that it's a lookup, if its clones
+      call register_clone(); if they don't, it's find_objects() again.
+*/
+object *
+query_clones( string file )
+{
+   if ( !( file = program_key( file ) ) )
+      return ({ });
+
+   if ( !mappingp( clones[ file ] ) || !hooked[ file ] )
+      rescan( file );
+   asked[ file ] = time();
+
+   return filter_array( m_indices( clones[ file ] ), #'objectp );
+}
+
+string *
+query_watched()
+{
+   return m_indices( asked );
+}
+
+
+//----------------------------------- misc ----------------------------------//
+
+status
+query_prevent_shadow()
+{
+   return 1;
+}
+
+void
+create()
+{
+   seteuid( getuid() );
+
+   clones = ([ ]);
+   asked = ([ ]);
+   queue = ({ });
+   hooked = ([ ]);
+   call_out( "reconcile", RECONCILE_TIME );
+}
+
+no_clean_up(int ref)
+{
+return 1;
+}
@@ -125,6 +125,7 @@
 
 #include <acme.h>
 
+private inherit AcmeArray;
 inherit AcmeError;
 inherit AcmeFile;
 inherit AcmeString;
@@ -132,6 +133,7 @@ inherit AcmeForceLoad;
 inherit AcmeShadow;
 static  inherit AcmeCallSecurity;
 
+#include AcmeArrayInc
 #include AcmeErrorInc
 #include AcmeFileInc
 #include AcmeStringInc
@@ -165,6 +167,10 @@ private static closure modeq_cl;
 
 private static status initialized;
 
+// site targets of ActionDB[ eSite ], as a trie from AcmeUserIndex;
+// zeroed whenever ActionDB changes and rebuilt on the next site event
+private static mapping site_trie;
+
 
 //--------------------------------- security --------------------------------//
 
@@ -173,17 +179,17 @@ static object *
 sec_caller_stack()
 {
   int i, size;
-  object ob;
   object *list;
-  list = ( initialized || THISI ) ? ({ THISI }) : ({ });
-  
-  for(i = 0, size = efun::caller_stack_depth(); i < size; i++)
-  {
-    ob = efun::previous_object(i);
-    if(efun::member(list, ob) == -1)
-      list += ({ ob });
-  }
-  return list;
+
+  size = efun::caller_stack_depth();
+  list = allocate( size + 1 );
+  list[0] = THISI;
+  for(i = 0; i < size; i++)
+    list[i + 1] = efun::previous_object(i);
+
+  if( !initialized && !THISI )
+    list = list[1..];
+  return unique_array_ordered( list, 0 );
 }
 
 static void
@@ -234,6 +240,7 @@ load_db( string file )
 
    AllowedTest();
 
+   site_trie = 0;
    dirty = 0;
    if ( !restore_object( file || DefDBFile ) )
       ActionDB = ([]);
@@ -288,6 +295,7 @@ add_targ_i( string event, string targ, string module, mixed data )
 {
    AllowedTestRet( 0 );
 
+   site_trie = 0;
    if ( !ValidEvent( event ) )
       return error( ERR_ERROR, sprintf( "Invalid event type %O.\n"
          "Valid types are:\n%s.", event, ValidEventStr ), 0 );
@@ -312,6 +320,7 @@ add_target( string event, string targ, string module, string cmd_line )
 {
    AllowedTestRet( 0 );
 
+   site_trie = 0;
    if ( !ValidEvent( event ) )
       return error( ERR_ERROR, sprintf( "Invalid event type %O.\n"
          "Valid types are:\n%s.", event, ValidEventStr ), 0 );
@@ -339,6 +348,7 @@ remove_target( mixed event, mixed targ, mixed module )
 
    AllowedTestRet( 0 );
 
+   site_trie = 0;
    if ( ValidEvent( event ) )
       if ( ValidTarg( targ ) )
          if ( TargInDB( event, targ ) )
@@ -486,6 +496,26 @@ do_cmds( string key, mixed cmds, object targ, mixed extra )
    map_array( cmds[ key ], "do_cmd", THISO, targ, extra );
 }
 
+// the actions for site targets matching host, same as filtering them
+// with site_match() but without looking at every target
+private mapping
+site_actions( mapping actions, string host )
+{
+   mapping out;
+   string *targs;
+   int i, size;
+
+   if ( !site_trie )
+      site_trie = AcmeUserIndex->make_site_trie( m_indices( actions ) );
+
+   out = ([ ]);
+   targs = AcmeUserIndex->match_site_trie( site_trie, host );
+   for ( i = 0, size = sizeof( targs ); i < size; i++ )
+      if ( member( actions, targs[ i ] ) )
+         out[ targs[ i ] ] = actions[ targs[ i ] ];
+   return out;
+}
+
 varargs private void
 event_handler( string event, object targ, mixed extra )
 {
@@ -516,7 +546,7 @@ event_handler( string event, object targ, mixed extra )
       break;
 
    case eSite:        // a site logs on -- extra is the ip
-      actions = filter_mapping( actions, "site_match", THISO, extra );
+      actions = site_actions( actions, extra );
       break;
 
    case eLogon:       // a player logs on -- extra is the player name
@@ -0,0 +1,93 @@
+/*
+    NAME
+
+        target_flush.c - Acme Target Cache Flusher
+
+    DESCRIPTION
+
+        Every object that inherits AcmeFindTarget keeps its own cache
+        of what quiet find_targets() calls found, so a tool that
+        writes a file can't reach the caches of the ospec engine or of
+        other tools to clear them.  Instead, each cached result is
+        stamped with query_stamp() for its player, and is only used
+        while the stamp hasn't changed.  flush() changes it, for one
+        player or for everyone, which makes every copy of the cache
+        look again.
+
+      API
+
+        query_stamp()       - the current stamp for a player
+        flush()             - make everyone's cached results for a
+                              player (or for all players) stale
+
+    NOTES
+
+        Nothing is cached here, only counters, so calling flush() can
+        make a lookup slower but can't change what it finds.
+
+*/
+
+#include <acme.h>
+#include AcmeTargetFlushInc
+
+private static mapping stamps;   // player : times flushed
+private static int everyone;     // times everything was flushed
+
+
+/*----------------------------- query_stamp ---------------------------*/
+/*
+    Description:
+      Finds the current stamp for a player's cached results.
+    Parameters:
+      who - the player
+    Returns:
+      A number that goes up every time who's results, or everyone's,
+      are flushed.
+    Notes:
+      None.
+*/
+int
+query_stamp( object who )
+{
+   return everyone + stamps[ who ];
+}
+
+/*----------------------------- flush ---------------------------*/
+/*
+    Description:
+      Makes cached find_targets() results stale.
+    Parameters:
+      who - only this player's results (optional)
+    Returns:
+      Nothing.
+    Notes:
+      Dead players fall out of the mapping on their own.
+*/
+varargs void
+flush( object who )
+{
+   if ( who )
+      stamps[ who ]++;
+   else
+      everyone++;
+}
+
+
+//----------------------------------- misc ----------------------------------//
+
+status
+query_prevent_shadow()
+{
+   return 1;
+}
+
+void
+create()
+{
+   stamps = ([ ]);
+}
+
+no_clean_up(int ref)
+{
+return 1;
+}
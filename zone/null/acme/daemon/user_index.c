@@ -0,0 +1,408 @@
+/*
+    NAME
+
+        user_index.c - Acme User Index
+
+    DESCRIPTION
+
+        Keeps track of the connected users, bucketed by OrdLevel, so
+        that questions like "which wizards are on?" can be answered
+        without calling GetOrdLevel() in every user.  Also keeps their
+        hostnames in a trie of reversed labels (edu -> stanford -> cs),
+        so "everyone from stanford.edu" doesn't need a regexp per user.
+
+        The index is kept up to date by the same NOTIFIER logon and
+        logout events the sentinel uses.  Since nobody tells us when
+        a user is promoted, the whole index is also rebuilt from
+        users() every RECONCILE_TIME seconds.  Anything that changes a
+        user's level can call update_user() to make it show up sooner.
+        Levels here can be that far behind, so filtering a given list
+        of users still asks each of them (see level_range()).
+
+      API
+
+        query_level_range() - users whose OrdLevel is in a range
+        query_host_suffix() - users whose hostname ends in some domain
+        update_user()       - refile one user
+        reindex()           - rebuild the whole index (from our call_out)
+
+        The hostname trie code is also available for other lists of
+        hostnames, like the sentinel's site targets:
+
+        make_site_trie()    - build a trie out of some hostnames
+        match_site_trie()   - find the ones that match a hostname
+
+    NOTES
+
+        Only NOTIFIER's logon and logout events are listened to, and
+        only this object reindexes itself.  update_user() can be called
+        by anyone, but it only refiles a user from GetOrdLevel() and
+        query_ip_name(), so it can't hide a connected user or add one
+        who isn't interactive.  Destructed users fall out of the
+        mappings on their own.
+
+*/
+
+#include <acme.h>
+#include AcmeUserIndexInc
+
+#define RECONCILE_TIME  300
+
+private static mapping levels;   // user : OrdLevel
+private static mapping buckets;  // OrdLevel : ([ user : 1 ])
+
+// Each node of a trie maps a hostname label to the node below it.  In
+// the host trie, node[0] holds ([ user : 1 ]) for every user whose
+// hostname ends in the labels leading to that node.  In a site trie,
+// node[0] holds the sites that end exactly there.
+private static mapping hosts;    // user : reversed labels of hostname
+private static mapping host_trie;
+
+#define SiteLabels(s)   (reverse_array( explode( lower_case( s ), "." ) ))
+
+
+//---------------------------------- index ----------------------------------//
+
+private string *
+reverse_array( string *list )
+{
+   int i, size;
+   string *out;
+
+   out = allocate( size = sizeof( list ) );
+   for ( i = 0; i < size; i++ )
+      out[ i ] = list[ size - i - 1 ];
+   return out;
+}
+
+private void
+add_host( object who )
+{
+   mapping node;
+   string *labels;
+   int i, size;
+
+   if ( !stringp( query_ip_name( who ) ) )
+      return;
+
+   hosts[ who ] = labels = SiteLabels( query_ip_name( who ) );
+   node = host_trie;
+   for ( i = 0, size = sizeof( labels ); i < size; i++ )
+   {
+      if ( !mappingp( node[ labels[ i ] ] ) )
+         node[ labels[ i ] ] = ([ 0 : ([ ]) ]);
+      node = node[ labels[ i ] ];
+      node[ 0 ][ who ] = 1;
+   }
+}
+
+private void
+remove_host( object who )
+{
+   mapping node, *path;
+   string *labels;
+   int i, size;
+
+   if ( !member( hosts, who ) )
+      return;
+
+   labels = hosts[ who ];
+   m_delete( hosts, who );
+
+   path = allocate( size = sizeof( labels ) );
+   node = host_trie;
+   for ( i = 0; i < size && mappingp( node = node[ labels[ i ] ] ); i++ )
+   {
+      m_delete( node[ 0 ], who );
+      path[ i ] = node;
+   }
+
+   // Prune the branches nobody is using anymore, from the leaf up.
+   for ( i = size - 1; i >= 0; i-- )
+   {
+      if ( !path[ i ] || sizeof( path[ i ][ 0 ] ) )
+         continue;
+      m_delete( i ? path[ i - 1 ] : host_trie, labels[ i ] );
+   }
+}
+
+private void
+remove_user( object who )
+{
+   int lv;
+
+   remove_host( who );
+   if ( !member( levels, who ) )
+      return;
+
+   lv = levels[ who ];
+   m_delete( levels, who );
+   if ( mappingp( buckets[ lv ] ) )
+   {
+      m_delete( buckets[ lv ], who );
+      if ( !sizeof( buckets[ lv ] ) )
+         m_delete( buckets, lv );
+   }
+}
+
+private void
+add_user( object who )
+{
+   int lv;
+
+   if ( !objectp( who ) || !interactive( who ) )
+      return;
+
+   remove_user( who );
+   lv = GetOrdLevel( who );
+   levels[ who ] = lv;
+   if ( !mappingp( buckets[ lv ] ) )
+      buckets[ lv ] = ([ ]);
+   buckets[ lv ][ who ] = 1;
+   add_host( who );
+}
+
+void
+update_user( object who )
+{
+   if ( objectp( who ) && interactive( who ) )
+      add_user( who );
+   else
+      remove_user( who );
+}
+
+private void
+build_index()
+{
+   object *u;
+   int i, size;
+
+   while ( remove_call_out( "reindex" ) != -1 )
+      ;
+
+   levels = ([ ]);
+   buckets = ([ ]);
+   hosts = ([ ]);
+   host_trie = ([ ]);
+   for ( u = users(), i = 0, size = sizeof( u ); i < size; i++ )
+      add_user( u[ i ] );
+
+   call_out( "reindex", RECONCILE_TIME );
+}
+
+void
+reindex()
+{
+   if ( previous_object() != THISO )
+      return;
+   build_index();
+}
+
+
+//--------------------------------- queries ---------------------------------//
+
+/*----------------------------- query_level_range ---------------------------*/
+/*
+    Description:
+      Finds all the connected users within a range of OrdLevels.
+    Parameters:
+      min - minimum OrdLevel of users to return
+      max - maximum OrdLevel of users to return
+    Returns:
+      An array of users.
+    Notes:
+      Takes time proportional to the number of levels in use plus the
+      number of users returned.
+*/
+object *
+query_level_range( int min, int max )
+{
+   object *list;
+   int *lvs;
+   int i, size;
+
+   list = ({ });
+   for ( lvs = m_indices( buckets ), i = 0, size = sizeof( lvs ); i < size;
+         i++ )
+      if ( lvs[ i ] >= min && lvs[ i ] <= max )
+         list += m_indices( buckets[ lvs[ i ] ] );
+   return filter_array( list, #'objectp );
+}
+
+/*----------------------------- query_host_suffix ---------------------------*/
+/*
+    Description:
+      Finds all the connected users from some domain.
+    Parameters:
+      suffix - a domain name, like "stanford.edu"
+    Returns:
+      An array of users whose hostname is suffix or ends in "."+suffix.
+    Notes:
+      Case doesn't matter.  Takes time proportional to the number of
+      labels in suffix plus the number of users returned.
+*/
+object *
+query_host_suffix( string suffix )
+{
+   mapping node;
+   string *labels;
+   int i, size;
+
+   if ( !stringp( suffix ) )
+      return ({ });
+   if ( suffix[ 0..0 ] == "." )
+      suffix = suffix[ 1.. ];
+
+   labels = SiteLabels( suffix );
+   node = host_trie;
+   for ( i = 0, size = sizeof( labels ); i < size; i++ )
+      if ( !mappingp( node = node[ labels[ i ] ] ) )
+         return ({ });
+   return ( node == host_trie ) ? ({ }) 
+                                : filter_array( m_indices( node[ 0 ] ),
+                                                #'objectp );
+}
+
+/*----------------------------- make_site_trie ---------------------------*/
+/*
+    Description:
+      Builds a trie out of a list of hostnames or domains.
+    Parameters:
+      sites - an array of strings like "princeton.edu"
+    Returns:
+      A trie, for use with match_site_trie().
+    Notes:
+      Build it once and hang on to it for as long as sites doesn't
+      change.
+*/
+mapping
+make_site_trie( string *sites )
+{
+   mapping trie, node;
+   string *labels;
+   int i, j, size, len;
+
+   trie = ([ ]);
+   for ( i = 0, size = sizeof( sites ); i < size; i++ )
+   {
+      if ( !stringp( sites[ i ] ) )
+         continue;
+      labels = SiteLabels( sites[ i ] );
+      node = trie;
+      for ( j = 0, len = sizeof( labels ); j < len; j++ )
+      {
+         if ( !mappingp( node[ labels[ j ] ] ) )
+            node[ labels[ j ] ] = ([ ]);
+         node = node[ labels[ j ] ];
+      }
+      node[ 0 ] = ( node[ 0 ] || ({ }) ) + ({ sites[ i ] });
+   }
+   return trie;
+}
+
+private string *
+all_sites( mapping node )
+{
+   string *out;
+   mixed *keys;
+   int i, size;
+
+   out = node[ 0 ] || ({ });
+   for ( keys = m_indices( node ), i = 0, size = sizeof( keys ); i < size;
+         i++ )
+      if ( stringp( keys[ i ] ) )
+         out += all_sites( node[ keys[ i ] ] );
+   return out;
+}
+
+/*----------------------------- match_site_trie ---------------------------*/
+/*
+    Description:
+      Finds the sites in a trie that match a hostname.
+    Parameters:
+      trie - from make_site_trie()
+      host - a hostname
+    Returns:
+      Every site for which one of site and host ends with the other,
+      comparing whole labels, ignoring case.
+    Notes:
+      That is the same test the sentinel's site_match() does, so
+      "princeton.edu" matches hosts in princeton.edu, and a host
+      named "princeton.edu" also matches "cs.princeton.edu".  Takes
+      time proportional to the labels in host plus the sites returned.
+*/
+string *
+match_site_trie( mapping trie, string host )
+{
+   mapping node;
+   string *labels, *out;
+   int i, size;
+
+   if ( !mappingp( trie ) || !stringp( host ) )
+      return ({ });
+
+   labels = SiteLabels( host );
+   node = trie;
+   out = ({ });
+   for ( i = 0, size = sizeof( labels ); i < size; i++ )
+   {
+      if ( !mappingp( node = node[ labels[ i ] ] ) )
+         return out;
+      if ( node[ 0 ] )
+         out += node[ 0 ];
+   }
+
+   // host ran out first, so everything further down ends with host.
+   return out - ( node[ 0 ] || ({ }) ) + all_sites( node );
+}
+
+
+//---------------------------------- events ---------------------------------//
+
+private status
+add_notification()
+{
+   if ( !NOTIFIER->add_notify( THISO ) )
+      return 0;
+   CHARON->add_object( 1 );  // CHARON doesn't give sucess status
+   return 1;
+}
+
+void
+notify_logon( object who, int recon )
+{
+   if ( previous_object() != find_object( NOTIFIER ) )
+      return;
+   add_user( who );
+}
+
+void
+notify_logout( object who, int discon )
+{
+   if ( previous_object() != find_object( NOTIFIER ) )
+      return;
+   remove_user( who );
+}
+
+
+//----------------------------------- misc ----------------------------------//
+
+status
+query_prevent_shadow()
+{
+   return 1;
+}
+
+void
+create()
+{
+   seteuid( getuid() );
+
+   add_notification();
+   build_index();
+}
+
+no_clean_up(int ref)
+{
+return 1;
+}
@@ -0,0 +1,282 @@
+/*
+** Opie engine benchmark
+**
+** Runs the specs in "corpus" through each engine, using the closures
+** Opie itself would use (opieServer->engine_handle()), on a world of
+** rooms, monsters and nested bags that is the same every run.  For
+** each spec and engine it reports:
+**
+**   eval/spec   - eval cost of one evaluation
+**   usecs/spec  - wall time of one evaluation (to the second only,
+**                 if the driver has no utime())
+**   size        - how many objects came back
+**   agree       - whether that's the same set of objects the first
+**                 engine found ("ref" for the first engine itself),
+**                 or "WRONG" if it isn't as many as the corpus says
+**
+** Usage:   "/zone/null/acme/opie/bench/bench.c"->run()
+**          "/zone/null/acme/opie/bench/bench.c"->run(file)
+**
+** The report goes to file (default results/<time>), along with the
+** driver version, so runs from before and after an upgrade can be
+** compared.  Each spec is done in its own call_out, so a big corpus
+** doesn't run out of evals.
+*/
+
+#include <acme.h>
+#include OpieInc
+
+#define BenchDir    opieDir "bench/"
+#define Thing       BenchDir "thing.c"
+#define Corpus      BenchDir "corpus"
+#define ResultDir   BenchDir "results/"
+
+// The engines, in the same order as the corpus columns.
+#define ENGINES     ({ opieAcmeSpec, opieTracer, opieBW })
+
+// The world
+#define ROOMS       4    // rooms
+#define MONSTERS    6    // monsters in each room
+#define BAG_DEPTH   3    // bags inside bags each monster carries
+#define BAG_ITEMS   3    // coins and gems in each bag
+#define ROCKS       8    // loose things in each room
+
+#define REPEAT      10   // evaluations of each spec per engine
+
+object *world;           // everything we cloned, so we can clean up
+string *labels;          // corpus[i]'s label
+string **specs;          // corpus[i][engine]'s spec, or 0
+int *expects;            // how many objects corpus[i] should find, or -1
+string out;              // the report file
+object user;             // who to tell when it's done
+int row;                 // next corpus line to run
+
+create()
+{
+  seteuid(getuid());
+}
+
+/*
+** Make a thing in env.  Values are worked out from a counter rather
+** than random(), so every run builds the same world.
+*/
+static object
+make_thing(object env, string name, string *ids, status live)
+{
+  object ob;
+
+  ob = clone_object(Thing);
+  ob->setup(name, ids, (sizeof(world) * 37) % 100, live);
+  if(env)
+    move_object(ob, env);
+  world += ({ ob });
+  return ob;
+}
+
+static void
+make_bag(object env, int depth)
+{
+  object bag;
+  int i;
+
+  bag = make_thing(env, "bag", ({ "bag" }), 0);
+  for(i = 0; i < BAG_ITEMS; i++)
+    if(i % 2)
+      make_thing(bag, "gem", ({ "gem", "treasure" }), 0);
+    else
+      make_thing(bag, "coin", ({ "coin", "treasure" }), 0);
+  if(depth > 1)
+    make_bag(bag, depth - 1);
+}
+
+static void
+make_world()
+{
+  object room, mob;
+  string kind;
+  int r, i;
+
+  world = ({ });
+  for(r = 0; r < ROOMS; r++)
+  {
+    room = make_thing(0, "room " + r, ({ "room" }), 0);
+    for(i = 0; i < MONSTERS; i++)
+    {
+      kind = (i % 2) ? "elf" : "orc";
+      mob = make_thing(room, kind, ({ kind, "monster" }), 1);
+      make_bag(mob, BAG_DEPTH);
+    }
+    for(i = 0; i < ROCKS; i++)
+      make_thing(room, "rock", ({ "rock" }), 0);
+  }
+}
+
+static void
+destroy_world()
+{
+  int i;
+
+  // Innermost things were made last, so this empties bags first.
+  for(i = sizeof(world) - 1; i >= 0; i--)
+    if(world[i])
+      destruct(world[i]);
+  world = 0;
+}
+
+/*
+** Read the corpus, putting the first room in for %ROOM%.
+*/
+static void
+read_corpus()
+{
+  string *lines, *cols, room;
+  int i, j, size;
+
+  room = "/" + object_name(world[0]);
+  labels = ({ });
+  specs = ({ });
+  expects = ({ });
+  lines = explode(read_file(Corpus) || "", "\n");
+  for(i = 0, size = sizeof(lines); i < size; i++)
+  {
+    if(!strlen(lines[i]) || (lines[i][0] == '#'))
+      continue;
+    cols = explode(lines[i], "|");
+    for(j = 0; j < sizeof(cols); j++)
+    {
+      cols[j] = implode(explode(cols[j], " ") - ({ "" }), " ");
+      if(cols[j] == "-")
+        cols[j] = 0;
+      else
+        cols[j] = implode(explode(cols[j], "%ROOM%"), room);
+    }
+    cols += allocate(2 + sizeof(ENGINES) - sizeof(cols));
+    labels += ({ cols[0] });
+    specs += ({ cols[1..sizeof(ENGINES)] });
+    expects += ({ cols[sizeof(ENGINES)+1] ? to_int(cols[sizeof(ENGINES)+1])
+                                          : -1 });
+  }
+}
+
+static int *
+wall_clock()
+{
+#if __EFUN_DEFINED__(utime)
+  return utime();
+#else
+  return ({ time(), 0 });
+#endif
+}
+
+/*
+** Evaluate spec REPEAT times with handle.
+** Returns ({ objects, eval cost, microseconds }).
+*/
+static mixed *
+time_spec(closure handle, string spec)
+{
+  object *obs;
+  int *start, *stop;
+  int eval, i;
+
+  start = wall_clock();
+  eval = get_eval_cost();
+  for(i = 0; i < REPEAT; i++)
+    obs = funcall(handle, spec, THISO, 0);
+  eval -= get_eval_cost();
+  stop = wall_clock();
+
+  return ({ pointerp(obs) ? obs : ({ }), eval,
+            (stop[0] - start[0]) * 1000000 + stop[1] - start[1] });
+}
+
+/*
+** Run one line of the corpus through every engine that can say it.
+*/
+static void
+run_row()
+{
+  mixed *res, *ref;
+  closure handle;
+  string agree, err;
+  int e;
+
+  for(e = 0; e < sizeof(ENGINES); e++)
+  {
+    if(!specs[row][e])
+      continue;
+
+    handle = (closure)opieServer->engine_handle(ENGINES[e]);
+    if(!closurep(handle))
+      err = "no engine";
+    else
+      err = catch(res = time_spec(handle, specs[row][e]));
+    if(err)
+    {
+      write_file(out, sprintf("%-10s %-24s error: %s\n",
+                              labels[row], ENGINES[e], err));
+      continue;
+    }
+
+    if(!ref)
+    {
+      ref = res[0];
+      agree = "ref";
+    }
+    else
+      agree = (sizeof(ref - res[0]) || sizeof(res[0] - ref)) ? "NO" : "yes";
+    if((expects[row] >= 0) && (sizeof(res[0]) != expects[row]))
+      agree = "WRONG";
+
+    write_file(out, sprintf("%-10s %-24s %10d %10d %6d %5s\n",
+                            labels[row], ENGINES[e],
+                            res[1] / REPEAT, res[2] / REPEAT,
+                            sizeof(res[0]), agree));
+  }
+
+  if(++row < sizeof(labels))
+  {
+    call_out("run_row", 0);
+    return;
+  }
+
+  destroy_world();
+  if(user)
+    tell_object(user, "Opie benchmark done: " + out + "\n");
+}
+
+/*
+** Start a run.  Returns 0 if one is already going.
+*/
+varargs status
+run(string file)
+{
+  if(world)
+    return 0;
+
+  if(!file)
+  {
+    if(file_size(ResultDir) != -2)
+      mkdir(ResultDir);
+    file = ResultDir + time();
+  }
+  out = file;
+  user = THISP;
+  row = 0;
+
+  make_world();
+  read_corpus();
+
+  write_file(out, sprintf("# Opie benchmark, driver %s, %s\n"
+                          "# %d rooms, %d objects, %d evaluations each\n"
+                          "%-10s %-24s %10s %10s %6s %5s\n",
+                          __VERSION__, ctime(time()),
+                          ROOMS, sizeof(world), REPEAT,
+                          "label", "engine", "eval/spec", "usecs/spec",
+                          "size", "agree"));
+  if(sizeof(labels))
+    call_out("run_row", 0);
+  else
+    destroy_world();
+  return 1;
+}
@@ -0,0 +1,31 @@
+/*
+** A thing in the Opie benchmark's world: a room, a monster, a bag,
+** or a coin, depending on how bench.c sets it up.
+**
+** It doesn't inherit anything from the mudlib, so the benchmark
+** measures the engines and not whatever the lib's objects do.
+*/
+
+string name;
+string *ids;
+int value;
+
+void
+setup(string n, string *i, int v, status live)
+{
+  name = n;
+  ids = i;
+  value = v;
+  if(live)
+    enable_commands();
+}
+
+status
+id(string str)
+{
+  return member(ids, str) != -1;
+}
+
+string short()          { return name; }
+string query_name()     { return name; }
+int    query_value()    { return value; }
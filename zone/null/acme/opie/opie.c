@@ -31,10 +31,56 @@
 */
 mapping handles;
 
+/*
+** engines[user][client] = ({ engine, expires, setting })
+**   user    - THISP when choose_engine() was called
+**   client  - the client's filename, without the clone number
+**   engine  - the filename choose_engine() came up with
+**   setting - the user's opie variable then, or 0 if it wasn't set
+**
+** Working out the engine takes four call_others before anything gets
+** parsed, and some tools call opie() once per target.  So remember it
+** for a while.  The user's variable is still looked at every time, and
+** the entry is thrown away if it has changed, so a setv or unsetv
+** counts right away; it's the client's default that's remembered.
+** forget_engine() throws entries away early.
+*/
+#define ENGINE_TTL     60
+#define E_ENGINE       0
+#define E_EXPIRES      1
+#define E_SETTING      2
+
+static mapping engines;
+
+static string user_setting();
+static string find_engine(object client, string setting);
+
+/*
+** results[id] = ({ objects, owner, user, expires, engine, size })
+**
+** Result sets kept by store() and refine(), so a tool can page through
+** a big spec, or narrow it down, without evaluating it again.  Objects
+** are only weakly held: destructed ones just turn into 0 and are
+** skipped by fetch().  A set goes away RESULT_TTL seconds after it was
+** last used, or when it's released.
+*/
+#define RESULT_TTL     600
+#define R_OBJECTS      0
+#define R_OWNER        1   // object that stored it
+#define R_USER         2   // THISP when it was stored
+#define R_EXPIRES      3
+#define R_ENGINE       4   // engine that made it, for refine()
+#define R_SIZE         5
+
+static mapping results;
+static int result_counter;
+
 create()
 {
   seteuid(getuid());
   handles = ([ ]);
+  engines = ([ ]);
+  results = ([ ]);
 }
 
 closure
@@ -61,14 +107,67 @@ engine_handle( string name )
 /*
 ** Return filename of parse engine to use.
 */
-varargs string 
+varargs string
 choose_engine(object client)
+{
+  mapping mine;
+  mixed *entry;
+  string prog, engine, setting;
+
+  if(!client)
+    client = previous_object();
+
+  prog = explode(object_name(client), "#")[0];
+  setting = user_setting();
+  if((mine = engines[THISP])
+     && (entry = mine[prog])
+     && (entry[E_EXPIRES] > time())
+     && (entry[E_SETTING] == setting))
+    return entry[E_ENGINE];
+
+  engine = find_engine(client, setting);
+
+  if(!mine)
+    engines[THISP] = mine = ([ ]);
+  mine[prog] = ({ engine, time() + ENGINE_TTL, setting });
+  return engine;
+}
+
+/*
+** Forget which engines have been chosen for who (or for everyone), so
+** the next call asks their tools for a default again.
+*/
+varargs void
+forget_engine(object who)
+{
+  if(!who)
+    engines = ([ ]);
+  else
+    m_delete(engines, who);
+}
+
+/*
+** The user's opie variable, or 0 if it isn't set.
+*/
+static string
+user_setting()
+{
+  if(THISP->_IsVariableSet(opieVar))
+    return THISP->_ExpandVariable(opieVar);
+  return 0;
+}
+
+/*
+** Work out which engine to use, the slow way.  setting is what
+** user_setting() said.
+*/
+static string
+find_engine(object client, string setting)
 {
   string engine;
-  
+
   /* Check the user's preference */
-  if(THISP->_IsVariableSet(opieVar)
-     && (engine = THISP->_ExpandVariable(opieVar)))
+  if(engine = setting)
   {
     if(engine == "0")
       printf(
@@ -81,9 +180,6 @@ choose_engine(object client)
       return engine;
   }
 
-  if(!client)
-    client = previous_object();
-
   /* else, Check the tool's default */
   if(engine = client->query(opieVar))
     return engine;
@@ -114,6 +210,9 @@ opie(string arg, string priorities)
 
 /*
 ** Use this if you want just a single object
+**
+** Engines that understand the optional limit argument can stop as
+** soon as they have found one object.  The others ignore it.
 */
 varargs object
 opie1(string arg, string priorities)
@@ -125,10 +224,239 @@ opie1(string arg, string priorities)
   if(!closurep( handle ))
     return 0;
 
-  obs = funcall(handle, arg, previous_object(), priorities);
+  obs = funcall(handle, arg, previous_object(), priorities, 1);
   return (pointerp(obs) && sizeof(obs)) ? obs[0] : 0;
 }
 
+/*
+** Evaluate a batch of specs, for tools that take several at once.
+** Returns one result per spec, in the same order, each being what
+** opie() would have returned for it.
+**
+** limits, if given, has a limit for each spec, like opie1()'s 1; a
+** spec with a limit of 1 gives an array of at most one object.
+**
+** The engine is only chosen once.  Engines that define
+** evaluate_object_specs() get the whole batch, so they can share
+** their setup between the specs; the others get called once per spec.
+*/
+varargs mixed *
+opie_many(string *specs, string priorities, int *limits)
+{
+  mixed *lists;
+  string engine;
+  closure func;
+  int i, size;
+
+  if(!pointerp(specs))
+    return 0;
+
+  engine = choose_engine();
+  if(closurep(func = symbol_function(opieManyFunc, engine)))
+    return funcall(func, specs, previous_object(), priorities, limits);
+
+  if(!closurep(func = engine_handle(engine)))
+    return 0;
+
+  lists = allocate(size = sizeof(specs));
+  for(i = 0; i < size; i++)
+    lists[i] = (i < sizeof(limits))
+      ? funcall(func, specs[i], previous_object(), priorities, limits[i])
+      : funcall(func, specs[i], previous_object(), priorities);
+  return lists;
+}
+
+/*
+** Evaluate a spec and find out what each term of it cost.
+** Returns ({ objects, rows }) as described in the README, or 0 if
+** the engine doesn't do profiling.
+*/
+varargs mixed *
+profile(string arg, string priorities)
+{
+  string engine;
+  closure func;
+
+  engine = choose_engine();
+  if(!engine
+     || !closurep(func = symbol_function(opieProfileFunc, engine)))
+    return 0;
+
+  return funcall(func, arg, previous_object(), priorities);
+}
+
+/*
+** Same thing, as a table that's ready to print.
+*/
+varargs string
+profile_report(string arg, string priorities)
+{
+  mixed *prof, row;
+  string out;
+  int i, size, eval, usecs;
+
+  if(!(prof = profile(arg, priorities)))
+    return "That parser can't profile specs.\n";
+
+  out = sprintf("%-4s %-3s %-24s %-16s %6s %6s %8s %9s\n",
+                "dep", "sub", "term", "kind", "in", "out", "eval", "usecs");
+  for(i = 0, size = sizeof(prof[1]); i < size; i++)
+  {
+    row = prof[1][i];
+    out += sprintf("%-4d %-3d %-24s %-16s %6d %6d %8d %9d\n",
+                   row["depth"], row["subspec"],
+                   sprintf("%*s%s", 2 * row["depth"], "", row["term"]),
+                   row["kind"] + (row["streamed"] ? "*" : ""),
+                   row["in"], row["out"], row["eval"], row["usecs"]);
+    if(!row["depth"])
+    {
+      eval += row["eval"];
+      usecs += row["usecs"];
+    }
+  }
+  out += sprintf("%d object%s, %d eval, %d usecs.  "
+                 "* means evaluated one object at a time.\n",
+                 sizeof(prof[0]), sizeof(prof[0]) == 1 ? "" : "s",
+                 eval, usecs);
+  return out;
+}
+
+/*
+** Result sets.  The owner of a set is the object that stored it, and
+** the player who was using it at the time; either may use it.
+*/
+static mixed *
+result_set(int id)
+{
+  mixed *set;
+
+  if(!(set = results[id]))
+    return 0;
+  if(set[R_EXPIRES] < time())
+  {
+    m_delete(results, id);
+    return 0;
+  }
+  if((previous_object() != set[R_OWNER]) && (THISP != set[R_USER]))
+    return 0;
+  set[R_EXPIRES] = time() + RESULT_TTL;
+  return set;
+}
+
+static void
+expire_results()
+{
+  int *ids;
+  int i;
+
+  for(ids = m_indices(results), i = sizeof(ids); i--; )
+    if(results[ids[i]][R_EXPIRES] < time())
+      m_delete(results, ids[i]);
+}
+
+static int
+new_result_set(object *obs, string engine)
+{
+  mixed *set;
+
+  // Throw out anything that has expired while we're here.
+  if(!(result_counter % 32))
+    expire_results();
+
+  set = allocate(R_SIZE);
+  set[R_OBJECTS] = pointerp(obs) ? obs : ({ });
+  set[R_OWNER]   = previous_object();
+  set[R_USER]    = THISP;
+  set[R_EXPIRES] = time() + RESULT_TTL;
+  set[R_ENGINE]  = engine;
+  results[++result_counter] = set;
+  return result_counter;
+}
+
+/*
+** Evaluate a spec and keep the result.  Returns a handle for
+** fetch(), refine(), and release().
+*/
+varargs int
+store(string arg, string priorities)
+{
+  string engine;
+  closure handle;
+
+  handle = engine_handle( engine = choose_engine() );
+  if(!closurep( handle ))
+    return 0;
+
+  return new_result_set(funcall(handle, arg, previous_object(), priorities),
+                        engine);
+}
+
+/*
+** Get <count> objects of a stored set, starting at <start> (all the
+** rest if count is 0), or 0 if the handle has expired or isn't yours.
+** So fetch(h, 20, 20) is the second page of 20.
+*/
+varargs object *
+fetch(int id, int start, int count)
+{
+  mixed *set;
+  object *obs;
+
+  if(!(set = result_set(id)))
+    return 0;
+  obs = filter_array(set[R_OBJECTS], #'objectp);
+  set[R_OBJECTS] = obs;
+  if(count > 0)
+    return obs[start..start+count-1];
+  return obs[start..];
+}
+
+/*
+** How many objects are in a stored set, or -1 if it's gone.
+*/
+int
+result_size(int id)
+{
+  mixed *set;
+
+  if(!(set = result_set(id)))
+    return -1;
+  return sizeof(set[R_OBJECTS] = filter_array(set[R_OBJECTS], #'objectp));
+}
+
+/*
+** Apply more terms to a stored set, as if they came after the spec
+** that made it, and keep that as a new set.  Only works with engines
+** that define the optional refine function.  Returns a new handle.
+*/
+varargs int
+refine(int id, string arg, string priorities)
+{
+  mixed *set;
+  closure func;
+
+  if(!(set = result_set(id))
+     || !closurep(func = symbol_function(opieRefineFunc, set[R_ENGINE])))
+    return 0;
+
+  return new_result_set(funcall(func, arg,
+                                filter_array(set[R_OBJECTS], #'objectp),
+                                previous_object(), priorities),
+                        set[R_ENGINE]);
+}
+
+/*
+** Forget a stored set.
+*/
+status
+release(int id)
+{
+  if(!result_set(id))
+    return 0;
+  m_delete(results, id);
+  return 1;
+}
+
 /*
 ** Return values can be either a single object
 ** or an array of objects.